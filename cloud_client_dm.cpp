@@ -17,7 +17,9 @@
 #include "mbed.h"
 #include "MbedCloudClient.h"
 #include "CloudClientStorage.h"
+#include "mbed-client/m2mreporthandler.h"
 #include "cloud_client_dm.h"
+#include "cloud_client_dm_log.h"
 
 #if defined(MBED_CONF_MBED_TRACE_ENABLE) && MBED_CONF_MBED_TRACE_ENABLE
 #include "mbed_trace.h"
@@ -28,7 +30,22 @@
 #include "update_ui_example.h"
 #endif
 
-#define printfLog(format, ...) debug_if(_debugOn, format, ## __VA_ARGS__)
+#define printfLog(format, ...) CLOUD_CLIENT_DM_LOG_INFO(_debugOn, format, ## __VA_ARGS__)
+#define printfLogError(format, ...) CLOUD_CLIENT_DM_LOG_ERROR(_debugOn, format, ## __VA_ARGS__)
+#define printfLogWarn(format, ...) CLOUD_CLIENT_DM_LOG_WARN(_debugOn, format, ## __VA_ARGS__)
+
+/**********************************************************************
+ * TYPES
+ **********************************************************************/
+
+// Indexes into the connectivity statistics counters.
+enum {
+    CONN_STATS_TX_BYTES = 0,
+    CONN_STATS_RX_BYTES = 1,
+    CONN_STATS_TX_PACKETS = 2,
+    CONN_STATS_RX_PACKETS = 3,
+    CONN_STATS_MAX_PACKET_SIZE = 4
+};
 
 /**********************************************************************
  * STATIC VARIABLES
@@ -59,6 +76,195 @@ static const char * deviceObjectResourceString[] = {"mbed.Manufacturer",
                                                     "mbed.Timezone",
                                                     "mbed.SupportedBindingMode"};
 
+// The order in which the Device object resources recorded in
+// queue mode are flushed, most important first.
+static const M2MDevice::DeviceResource queueFlushOrder[] = {M2MDevice::ErrorCode,
+                                                            M2MDevice::BatteryStatus,
+                                                            M2MDevice::BatteryLevel,
+                                                            M2MDevice::AvailablePowerSources,
+                                                            M2MDevice::PowerSourceVoltage,
+                                                            M2MDevice::PowerSourceCurrent,
+                                                            M2MDevice::MemoryFree,
+                                                            M2MDevice::MemoryTotal,
+                                                            M2MDevice::FirmwareVersion,
+                                                            M2MDevice::SoftwareVersion,
+                                                            M2MDevice::UTCOffset,
+                                                            M2MDevice::Timezone};
+
+// The built-in power policy table: report everything while the
+// battery is healthy, then back off progressively.
+static const CloudClientDm::PowerPolicy defaultPowerPolicyTable[] = {
+    {50, 0, 0, 0, 0},
+    {20, 300, 60, 50, 10},
+    {0, 900, 300, 100, 20}
+};
+
+// The Device object resources that are critical by default (see
+// setUpdatePriority()), everything else being normal; bulk is opt-in.
+static const M2MDevice::DeviceResource defaultCriticalResources[] = {M2MDevice::ErrorCode,
+                                                                     M2MDevice::BatteryStatus};
+
+// The radio costs used if none are given to setRadioAccounting(),
+// roughly those of an LTE-M modem.
+static const CloudClientDm::RadioCosts defaultRadioCosts = {5000, 2000, 200000, 10000};
+
+// The CoAP transfer parameters recommended for a link quality:
+// minimum quality, block size, ACK time-out, retransmissions.
+static const struct {
+    int minQualityPercent;
+    int blockSize;
+    int ackTimeoutSeconds;
+    int maxRetransmissions;
+} linkQualityTable[] = {
+    {80, 1024, 2, 4},
+    {60, 512, 3, 4},
+    {40, 256, 4, 5},
+    {20, 128, 6, 6},
+    {0, 64, 8, 6}
+};
+
+// Marks a Snapshot and its layout version.
+#define SNAPSHOT_MAGIC 0x43434453
+#define SNAPSHOT_VERSION 2
+
+// The Device object resources that make up the strings of a Snapshot.
+// Note: MUST have the same number of elements as CloudClientDm::SnapshotString
+static const M2MDevice::DeviceResource snapshotStringResource[] = {M2MDevice::SoftwareVersion,
+                                                                   M2MDevice::FirmwareVersion,
+                                                                   M2MDevice::UTCOffset,
+                                                                   M2MDevice::Timezone};
+
+// Cloud Client storage key prefix for spilled power source history,
+// to which the power source instance ID is appended.
+static const char * historyKeyPrefix = "ccdm.History";
+
+/**********************************************************************
+ * STATIC FUNCTIONS
+ **********************************************************************/
+
+// Encode a value as a varint, returning the number of bytes written.
+static int encodeVarint(uint8_t *buffer, uint32_t value)
+{
+    int length = 0;
+
+    do {
+        buffer[length] = value & 0x7F;
+        value >>= 7;
+        if (value != 0) {
+            buffer[length] |= 0x80;
+        }
+        length++;
+    } while (value != 0);
+
+    return length;
+}
+
+// Encode a CBOR data item head, major type plus argument,
+// returning the number of bytes written; buffer may be NULL.
+static int encodeCborHead(uint8_t *buffer, uint8_t majorType, uint64_t argument)
+{
+    int length;
+    uint8_t additional;
+
+    if (argument < 24) {
+        length = 1;
+        additional = (uint8_t) argument;
+    } else if (argument <= 0xFF) {
+        length = 2;
+        additional = 24;
+    } else if (argument <= 0xFFFF) {
+        length = 3;
+        additional = 25;
+    } else if (argument <= 0xFFFFFFFF) {
+        length = 5;
+        additional = 26;
+    } else {
+        length = 9;
+        additional = 27;
+    }
+
+    if (buffer != NULL) {
+        buffer[0] = (majorType << 5) | additional;
+        for (int x = 1; x < length; x++) {
+            buffer[x] = (uint8_t) (argument >> ((length - 1 - x) * 8));
+        }
+    }
+
+    return length;
+}
+
+// Encode a signed integer as CBOR; buffer may be NULL.
+static int encodeCborInt(uint8_t *buffer, int64_t value)
+{
+    if (value < 0) {
+        return encodeCborHead(buffer, 1, (uint64_t) (-1 - value));
+    }
+
+    return encodeCborHead(buffer, 0, (uint64_t) value);
+}
+
+// Encode a CBOR text or byte string; buffer may be NULL.
+static int encodeCborString(uint8_t *buffer, uint8_t majorType,
+                            const uint8_t *string, uint32_t length)
+{
+    int headLength = encodeCborHead(buffer, majorType, length);
+
+    if ((buffer != NULL) && (length > 0)) {
+        memcpy(buffer + headLength, string, length);
+    }
+
+    return headLength + length;
+}
+
+// Encode a single-precision float as CBOR; buffer may be NULL.
+static int encodeCborFloat(uint8_t *buffer, float value)
+{
+    uint32_t bits;
+
+    if (buffer != NULL) {
+        memcpy(&bits, &value, sizeof(bits));
+        buffer[0] = (7 << 5) | 26;
+        for (int x = 1; x < 5; x++) {
+            buffer[x] = (uint8_t) (bits >> ((4 - x) * 8));
+        }
+    }
+
+    return 5;
+}
+
+// Offset into a buffer that may be NULL.
+static uint8_t *offsetOf(uint8_t *buffer, int offset)
+{
+    return (buffer != NULL) ? buffer + offset : NULL;
+}
+
+// Calculate the CRC32 (IEEE 802.3) of a buffer; no table, to save flash.
+static uint32_t crc32(const uint8_t *buffer, size_t length)
+{
+    uint32_t crc = 0xFFFFFFFF;
+
+    while (length > 0) {
+        crc ^= *buffer;
+        for (int x = 0; x < 8; x++) {
+            crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+        }
+        buffer++;
+        length--;
+    }
+
+    return ~crc;
+}
+
+// Zigzag-encode a signed value, so that small negative
+// numbers encode as small varints.
+static uint32_t zigzag(int32_t value)
+{
+    return ((uint32_t) value << 1) ^ (uint32_t) (value >> 31);
+}
+
+// The instance that the static firmware update handlers pass on to.
+CloudClientDm *CloudClientDm::_updateInstance = NULL;
+
 /**********************************************************************
  * PROTECTED METHODS: CALLBACKS
  **********************************************************************/
@@ -69,7 +275,20 @@ void CloudClientDm::clientRegisteredCallback()
     static const ConnectorClientEndpointInfo* endpoint;
 
     _registered = true;
-    printfLog("Client registered.\n");
+    _stats.numRegistrations++;
+    if (_bootToRegisteredMs < 0) {
+        _bootToRegisteredMs = _bootTimer.read_ms();
+        printfLog("Boot to registered took %d ms.\n", _bootToRegisteredMs);
+    }
+    if (_awaitingRegistration) {
+        _awaitingRegistration = false;
+        _registrationTimer.stop();
+        _stats.lastRegistrationLatencyMs = _registrationTimer.read_ms();
+        if (_stats.lastRegistrationLatencyMs > _stats.maxRegistrationLatencyMs) {
+            _stats.maxRegistrationLatencyMs = _stats.lastRegistrationLatencyMs;
+        }
+    }
+    printfLog("Client registered (%d ms).\n", _stats.lastRegistrationLatencyMs);
 
     endpoint = _cloudClient.endpoint_info();
     if (endpoint != NULL) {
@@ -81,32 +300,125 @@ void CloudClientDm::clientRegisteredCallback()
         printfLog("Device ID: %s.\n", endpoint->internal_endpoint_name.c_str());
     }
 
+    // The server reads afresh whatever it observes, so only
+    // changes from now on (or still queued) have to be acknowledged
+    core_util_critical_section_enter();
+    _unackedResources = _queuedResources;
+    core_util_critical_section_exit();
+#if CLOUD_CLIENT_DM_DELIVERY_STATUS
+    if (_deviceObject != NULL) {
+        for (unsigned int x = 0; x < sizeof(queueFlushOrder) / sizeof(queueFlushOrder[0]); x++) {
+            M2MResource *resource = _deviceObject->get_resource(queueFlushOrder[x]);
+            if (resource != NULL) {
+                resource->set_message_delivery_status_cb(deliveryStatusCallback, this);
+            }
+        }
+    }
+#endif
+
+    // Send whatever changed while we were away
+    flushQueue();
+    updateLinkQuality(true);
+
     if (_registeredUserCallback) {
         _registeredUserCallback();
     }
+    publishEvent(EVENT_REGISTERED, 0);
 }
 
 // Callback for deregistration event
 void CloudClientDm::clientDeregisteredCallback()
 {
     _registered = false;
+    _closed = true;
+    _stats.numDeregistrations++;
     printfLog("Client deregistered.\n");
 
     if (_deregisteredUserCallback) {
         _deregisteredUserCallback();
     }
+    publishEvent(EVENT_DEREGISTERED, 0);
+}
+
+// Callback for registration updated event
+void CloudClientDm::clientRegistrationUpdatedCallback()
+{
+    // In queue-mode binding this is the client waking up
+    _queueSleeping = false;
+    printfLog("Client registration updated.\n");
+
+    flushQueue();
+    updateLinkQuality(true);
+    publishEvent(EVENT_REGISTRATION_UPDATED, 0);
+}
+
+// Callback for the client going to sleep in queue-mode binding
+void CloudClientDm::queueSleepCallback()
+{
+    _queueSleeping = true;
+    printfLog("Client sleeping.\n");
+
+    if (_queueSleepUserCallback) {
+        _queueSleepUserCallback();
+    }
 }
 
 // Callback for error event
 void CloudClientDm::errorCallback(int errorCode)
 {
-    printfLog("Error occurred: %s.\n", getMbedClientErrorString((MbedCloudClient::Error) errorCode));
-    printfLog("Error code: %d.\n", errorCode);
-    printfLog("Error details: %s.\n",_cloudClient.error_description());
+    _stats.numErrors++;
+    printfLogError("Error occurred: %s.\n", getMbedClientErrorString((MbedCloudClient::Error) errorCode));
+    printfLogError("Error code: %d.\n", errorCode);
+    printfLogError("Error details: %s.\n",_cloudClient.error_description());
+
+    if (_awaitingRegistration) {
+        _registrationFailed = true;
+    }
+
+    // Errors that mean an exchange with the server was lost
+    switch (errorCode) {
+        case MbedCloudClient::ConnectTimeout:
+        case MbedCloudClient::ConnectNetworkError:
+        case MbedCloudClient::ConnectSecureConnectionFailed:
+        case MbedCloudClient::ConnectDnsResolvingFailed:
+            updateLinkQuality(false);
+            break;
+        default:
+            break;
+    }
 
     if (_errorUserCallback) {
         _errorUserCallback(errorCode);
     }
+    publishEvent(EVENT_ERROR, errorCode);
+}
+
+// Callback for the Start resource of the Connectivity Statistics object
+void CloudClientDm::connectivityStatisticsStartCallback(void *argument)
+{
+    (void) argument;
+
+    printfLog("Connectivity statistics started by server.\n");
+    startConnectivityStatistics();
+}
+
+// Callback for the Stop resource of the Connectivity Statistics object
+void CloudClientDm::connectivityStatisticsStopCallback(void *argument)
+{
+    (void) argument;
+
+    printfLog("Connectivity statistics stopped by server.\n");
+    stopConnectivityStatistics();
+}
+
+// Callback for a write to the Collection Period resource of the
+// Connectivity Statistics object
+void CloudClientDm::connectivityStatisticsPeriodCallback(const char *name)
+{
+    (void) name;
+
+    // The collection period runs from when it was set
+    _connStatsTimer.reset();
 }
 
 /**********************************************************************
@@ -118,16 +430,18 @@ bool CloudClientDm::createDeviceObjectResource(M2MDevice::DeviceResource resourc
                                                const char *value)
 {
     bool success = false;
-    M2MDevice *deviceObject = M2MInterfaceFactory::create_device();
+    HeapMark heapMark;
 
-    if ((deviceObject != NULL) &&
-        (deviceObject->create_resource(resource, String(value, strlen(value))) != NULL)) {
+    heapTagBegin(&heapMark);
+    if ((_deviceObject != NULL) &&
+        (_deviceObject->create_resource(resource, String(value, strlen(value))) != NULL)) {
         success = true;
     } else {
-        printfLog("Error creating string resource \"%s\" on the Device object.\n",
-                  deviceObjectResourceString[resource]);
+        printfLogError("Error creating string resource \"%s\" on the Device object.\n",
+                       deviceObjectResourceString[resource]);
     }
 
+    heapTagEnd(HEAP_TAG_RESOURCES, &heapMark);
     return success;
 }
 
@@ -137,15 +451,17 @@ bool CloudClientDm::createDeviceObjectResource(M2MDevice::DeviceResource resourc
                                                int64_t value)
 {
     bool success = false;
-    M2MDevice *deviceObject = M2MInterfaceFactory::create_device();
+    HeapMark heapMark;
 
-    if ((deviceObject != NULL) && (deviceObject->create_resource(resource, value) != NULL)) {
+    heapTagBegin(&heapMark);
+    if ((_deviceObject != NULL) && (_deviceObject->create_resource(resource, value) != NULL)) {
         success = true;
     } else {
-        printfLog("Error creating single-instance integer resource \"%s\" on the Device object.\n",
-                  deviceObjectResourceString[resource]);
+        printfLogError("Error creating single-instance integer resource \"%s\" on the Device object.\n",
+                       deviceObjectResourceString[resource]);
     }
 
+    heapTagEnd(HEAP_TAG_RESOURCES, &heapMark);
     return success;
 }
 
@@ -155,16 +471,18 @@ bool CloudClientDm::createDeviceObjectResource(M2MDevice::DeviceResource resourc
                                                int64_t value, uint16_t instance)
 {
     bool success = false;
-    M2MDevice *deviceObject = M2MInterfaceFactory::create_device();
+    HeapMark heapMark;
 
-    if ((deviceObject != NULL) &&
-        (deviceObject->create_resource_instance(resource, value, instance) != NULL)) {
+    heapTagBegin(&heapMark);
+    if ((_deviceObject != NULL) &&
+        (_deviceObject->create_resource_instance(resource, value, instance) != NULL)) {
         success = true;
     } else {
-        printfLog("Error creating integer multi-instance resource \"%s\", instance %d, on the Device object.\n",
-                  deviceObjectResourceString[resource], instance);
+        printfLogError("Error creating integer multi-instance resource \"%s\", instance %d, on the Device object.\n",
+                       deviceObjectResourceString[resource], instance);
     }
 
+    heapTagEnd(HEAP_TAG_RESOURCES, &heapMark);
     return success;
 }
 
@@ -172,15 +490,17 @@ bool CloudClientDm::createDeviceObjectResource(M2MDevice::DeviceResource resourc
 bool CloudClientDm::createDeviceObjectResource(M2MDevice::DeviceResource resource)
 {
     bool success = false;
-    M2MDevice *deviceObject = M2MInterfaceFactory::create_device();
+    HeapMark heapMark;
 
-    if ((deviceObject != NULL) && (deviceObject->create_resource(resource) != NULL)) {
+    heapTagBegin(&heapMark);
+    if ((_deviceObject != NULL) && (_deviceObject->create_resource(resource) != NULL)) {
         success = true;
     } else {
-        printfLog("Error creating control resource \"%s\" on the Device object.\n",
-                  deviceObjectResourceString[resource]);
+        printfLogError("Error creating control resource \"%s\" on the Device object.\n",
+                       deviceObjectResourceString[resource]);
     }
 
+    heapTagEnd(HEAP_TAG_RESOURCES, &heapMark);
     return success;
 }
 
@@ -188,15 +508,17 @@ bool CloudClientDm::createDeviceObjectResource(M2MDevice::DeviceResource resourc
 bool CloudClientDm::deleteDeviceObjectResource(M2MDevice::DeviceResource resource)
 {
     bool success = false;
-    M2MDevice *deviceObject = M2MInterfaceFactory::create_device();
+    HeapMark heapMark;
 
-    if ((deviceObject != NULL) && deviceObject->delete_resource(resource)) {
+    heapTagBegin(&heapMark);
+    if ((_deviceObject != NULL) && _deviceObject->delete_resource(resource)) {
         success = true;
     } else {
-        printfLog("Error deleting single-instance resource \"%s\", on the Device object.\n",
-                  deviceObjectResourceString[resource]);
+        printfLogError("Error deleting single-instance resource \"%s\", on the Device object.\n",
+                       deviceObjectResourceString[resource]);
     }
 
+    heapTagEnd(HEAP_TAG_RESOURCES, &heapMark);
     return success;
 }
 
@@ -207,561 +529,3134 @@ bool CloudClientDm::deleteDeviceObjectResource(M2MDevice::DeviceResource resourc
                                                uint16_t instance)
 {
     bool success = false;
-    M2MDevice *deviceObject = M2MInterfaceFactory::create_device();
+    HeapMark heapMark;
 
-    if ((deviceObject != NULL) && deviceObject->delete_resource_instance(resource, instance)) {
+    heapTagBegin(&heapMark);
+    if ((_deviceObject != NULL) && _deviceObject->delete_resource_instance(resource, instance)) {
         success = true;
     } else {
-        printfLog("Error deleting multi-instance resource \"%s\", instance %d, on the Device object.\n",
-                  deviceObjectResourceString[resource], instance);
+        printfLogError("Error deleting multi-instance resource \"%s\", instance %d, on the Device object.\n",
+                       deviceObjectResourceString[resource], instance);
     }
 
+    heapTagEnd(HEAP_TAG_RESOURCES, &heapMark);
     return success;
 }
 
-// Set a Device object resource.
-bool CloudClientDm::setDeviceObjectResource(M2MDevice::DeviceResource resource,
-                                            std::string str)
+// Record that a Device object resource has changed, for queue mode
+// if not registered, for the drain phase of stop() and for the
+// statistics of its priority class.
+void CloudClientDm::queueDeviceObjectResource(M2MDevice::DeviceResource resource,
+                                              int delayMs)
 {
-    bool success;
+    int nowMs = _bootTimer.read_ms();
+    bool queued = false;
 
-    // If we've not started, make sure the resource has been created
-    if (!_started) {
-        M2MDevice *deviceObject = M2MInterfaceFactory::create_device();
-        if ((deviceObject != NULL) && !deviceObject->is_resource_present(resource)) {
-            createDeviceObjectResource(resource, str.c_str());
+    core_util_critical_section_enter();
+    if (_queueMode && (!_registered || _queueSleeping)) {
+        if (_queuedResources == 0) {
+            _queuedSinceMs = nowMs;
         }
+        _queuedResources |= 1UL << resource;
+        queued = true;
     }
+    _unackedResources |= 1UL << resource;
+    core_util_critical_section_exit();
 
-    // Now set the value
-    success = _cloudClient.set_device_resource_value(resource, str);
+    if (_registered && !queued) {
+        setRadioOperation(RADIO_OP_DEVICE_OBJECT);
+        recordUpdateSent((UpdatePriority) _updatePriority[resource], delayMs);
+    }
+}
 
-    if (!success) {
-        printfLog("Error setting %s.\n", deviceObjectResourceString[resource]);
+// Hold back a Device object resource update for the next flush.
+bool CloudClientDm::deferUpdate(M2MDevice::DeviceResource resource, int instance,
+                                int64_t value)
+{
+    PendingUpdate *pendingUpdate = NULL;
+
+    // Replace the value of an update that is already waiting,
+    // keeping its place, or take a free slot
+    for (unsigned int x = 0; (x < sizeof(_pendingUpdate) / sizeof(_pendingUpdate[0])) && (pendingUpdate == NULL); x++) {
+        if (_pendingUpdate[x].used && (_pendingUpdate[x].resource == resource) &&
+            (_pendingUpdate[x].instance == instance)) {
+            pendingUpdate = &(_pendingUpdate[x]);
+        }
+    }
+    for (unsigned int x = 0; (x < sizeof(_pendingUpdate) / sizeof(_pendingUpdate[0])) && (pendingUpdate == NULL); x++) {
+        if (!_pendingUpdate[x].used) {
+            pendingUpdate = &(_pendingUpdate[x]);
+            pendingUpdate->resource = (uint8_t) resource;
+            pendingUpdate->instance = (int16_t) instance;
+            pendingUpdate->enqueuedMs = _bootTimer.read_ms();
+            pendingUpdate->used = true;
+        }
     }
 
-    return success;
+    if (pendingUpdate != NULL) {
+        pendingUpdate->value = value;
+        _stats.numUpdatesDeferred++;
+    }
+
+    return (pendingUpdate != NULL);
 }
 
-// Set a Device object resource.
-bool CloudClientDm::setDeviceObjectResource(M2MDevice::DeviceResource resource,
-                                            const char *value)
+// Check the free heap against the watermarks.
+void CloudClientDm::updateMemoryPressure()
 {
-    std::string str(value);
-    return setDeviceObjectResource(resource, str);
+#ifdef MBED_HEAP_STATS_ENABLED
+    mbed_stats_heap_t heapStats;
+    int freeBytes;
+    int level = _memoryShedLevel;
+
+    if (_memoryLowFreeBytes >= 0) {
+        mbed_stats_heap_get(&heapStats);
+        freeBytes = (int) (heapStats.reserved_size - heapStats.current_size);
+        if ((_memoryCriticalFreeBytes >= 0) && (freeBytes < _memoryCriticalFreeBytes)) {
+            // No time to lose, shed everything
+            level = MAX_NUM_MEMORY_SHED_LEVELS - 1;
+        } else if (freeBytes < _memoryLowFreeBytes) {
+            // Shed one more thing and see if that's enough
+            if (level < MAX_NUM_MEMORY_SHED_LEVELS - 1) {
+                level++;
+            }
+        } else if (freeBytes >= _memoryLowFreeBytes + CLOUD_CLIENT_MEMORY_HYSTERESIS_BYTES) {
+            if (level > MEMORY_SHED_NONE) {
+                level--;
+            }
+        }
+        setMemoryShedLevel((MemoryShedLevel) level, freeBytes);
+    }
+#endif
 }
 
-// Set a Device object resource.
-bool CloudClientDm::setDeviceObjectResource(M2MDevice::DeviceResource resource,
-                                            int64_t value)
+// Shed or restore features until the memory shed level is reached.
+void CloudClientDm::setMemoryShedLevel(MemoryShedLevel level, int freeBytes)
 {
-    bool success = false;
-    M2MDevice *deviceObject = M2MInterfaceFactory::create_device();
+    static const char *shedString[] = {"nothing", "history", "metrics"};
+    MemoryShedLevel restored;
+
+    while (_memoryShedLevel < level) {
+        _memoryShedLevel = (MemoryShedLevel) (_memoryShedLevel + 1);
+        switch (_memoryShedLevel) {
+            case MEMORY_SHED_HISTORY:
+                // updateDeviceObjectHistory() then empties the resource
+                for (uint16_t x = 0; x < sizeof(_history) / sizeof(_history[0]); x++) {
+                    deleteHistory(x);
+                }
+                break;
+            case MEMORY_SHED_METRICS:
+                if (_batchResource != NULL) {
+                    _batchResource->set_value(NULL, 0);
+                }
+                break;
+            default:
+                break;
+        }
+        _stats.numMemoryShedSteps++;
+        printfLogWarn("Memory low (%d byte(s) free), shed %s.\n", freeBytes,
+                      shedString[_memoryShedLevel]);
+        setDeviceObjectErrorCode(ERROR_OUT_OF_MEMORY);
+    }
 
-    if (deviceObject != NULL) {
-        // If we've not started, make sure the resource instance has been created
-        if ((deviceObject != NULL) && !deviceObject->is_resource_present(resource)) {
-            createDeviceObjectResource(resource, value);
+    while (_memoryShedLevel > level) {
+        restored = _memoryShedLevel;
+        _memoryShedLevel = (MemoryShedLevel) (_memoryShedLevel - 1);
+        switch (restored) {
+            case MEMORY_SHED_METRICS:
+                // The next publishBatch() fills the resource again
+                break;
+            case MEMORY_SHED_HISTORY:
+                // Histories start again from empty
+                for (uint16_t x = 0; x < sizeof(_powerSourceInstance) / sizeof(_powerSourceInstance[0]); x++) {
+                    if (_powerSourceInstance[x] != POWER_SOURCE_UNUSED) {
+                        createHistory(x);
+                    }
+                }
+                break;
+            default:
+                break;
+        }
+        _stats.numMemoryRestoreSteps++;
+        printfLog("Memory recovered (%d byte(s) free), restored %s.\n", freeBytes,
+                  shedString[restored]);
+        // Only clear the error if it is still ours
+        if ((_memoryShedLevel == MEMORY_SHED_NONE) && (_deviceObject != NULL) &&
+            (_deviceObject->resource_value_int(M2MDevice::ErrorCode, 0) == ERROR_OUT_OF_MEMORY)) {
+            setDeviceObjectErrorCode(ERROR_NONE);
         }
+    }
+}
 
-        // Now set the value
-        success = deviceObject->set_resource_value(resource, value);
+// Record an update sent in the statistics of its priority class.
+void CloudClientDm::recordUpdateSent(UpdatePriority priority, int delayMs)
+{
+    UpdateClassStats *updateClass = &(_stats.updateClass[priority]);
+
+    _stats.numNotifications++;
+    updateClass->numSent++;
+    updateClass->totalDelayMs += delayMs;
+    updateClass->lastDelayMs = delayMs;
+    if (delayMs > updateClass->maxDelayMs) {
+        updateClass->maxDelayMs = delayMs;
     }
+}
 
-    if (!success) {
-        printfLog("Error setting integer resource \"%s\" on the Device object.\n",
-                  deviceObjectResourceString[resource]);
+// Send everything that is held back and wait for the notifications
+// of the changed Device object resources to be acknowledged.
+void CloudClientDm::drain(int drainTimeoutMs)
+{
+    Timer timer;
+    uint32_t pending = 0;
+    M2MResource *resource;
+    int numPending = 0;
+    int numDropped = 0;
+
+    timer.start();
+
+    // Push out whatever queue mode, the power policy, the
+    // history and the resource handles have been holding back
+    flushPowerSourceResources(true);
+    flushUpdates();
+    updateDeviceObjectHistory();
+    flushResources();
+    flushQueue();
+
+    // Work out which changes the server is still waiting for; a
+    // resource that is not being observed will never be notified
+    // and so there's no point in waiting for it
+    for (unsigned int x = 0; x < sizeof(queueFlushOrder) / sizeof(queueFlushOrder[0]); x++) {
+        if (_unackedResources & (1UL << queueFlushOrder[x])) {
+            resource = _deviceObject->get_resource(queueFlushOrder[x]);
+            if ((resource != NULL) && resource->is_under_observation() &&
+                (resource->report_handler() != NULL)) {
+#if CLOUD_CLIENT_DM_DELIVERY_STATUS
+                resource->set_message_delivery_status_cb(deliveryStatusCallback, this);
+                // Send it again in case the first one was lost, the
+                // server will just see the same value twice
+                resource->report_handler()->set_notification_trigger();
+                _stats.numNotifications++;
+#endif
+                pending |= 1UL << queueFlushOrder[x];
+                numPending++;
+            }
+        }
+    }
+
+#if !CLOUD_CLIENT_DM_DELIVERY_STATUS
+    // No way to know when the server has them, just give
+    // them a moment to get out
+    if (drainTimeoutMs > CLOUD_CLIENT_DRAIN_SETTLE_MS) {
+        drainTimeoutMs = CLOUD_CLIENT_DRAIN_SETTLE_MS;
+    }
+#endif
+    printfLog("Draining %d notification(s) for up to %d ms...\n",
+              numPending, drainTimeoutMs);
+#if CLOUD_CLIENT_DM_DELIVERY_STATUS
+    while (((_unackedResources & pending) != 0) && (timer.read_ms() < drainTimeoutMs)) {
+        wait_ms(10);
+    }
+    for (unsigned int x = 0; x < sizeof(queueFlushOrder) / sizeof(queueFlushOrder[0]); x++) {
+        if (_unackedResources & pending & (1UL << queueFlushOrder[x])) {
+            printfLogError("%s not acknowledged before the deadline.\n",
+                           deviceObjectResourceString[queueFlushOrder[x]]);
+            numDropped++;
+        }
+    }
+#else
+    if (numPending > 0) {
+        while (timer.read_ms() < drainTimeoutMs) {
+            wait_ms(10);
+        }
+    }
+#endif
+
+    _stats.lastDrainMs = timer.read_ms();
+#if CLOUD_CLIENT_DM_DELIVERY_STATUS
+    _stats.lastDrainFlushed = numPending - numDropped;
+    _stats.lastDrainDropped = numDropped;
+    printfLog("Drain took %d ms: %d update(s) flushed, %d dropped.\n",
+              _stats.lastDrainMs, _stats.lastDrainFlushed, _stats.lastDrainDropped);
+#else
+    // Without acknowledgements it is anyone's guess
+    (void) numDropped;
+    _stats.lastDrainFlushed = -1;
+    _stats.lastDrainDropped = -1;
+    printfLog("Drain took %d ms: %d update(s) sent, unconfirmed.\n",
+              _stats.lastDrainMs, numPending);
+#endif
+}
+
+#if CLOUD_CLIENT_DM_DELIVERY_STATUS
+// Message delivery status callback for the Device object resources.
+void CloudClientDm::deliveryStatusCallback(const M2MBase &base,
+                                           M2MBase::MessageDeliveryStatus status,
+                                           M2MBase::MessageType type,
+                                           void *context)
+{
+    CloudClientDm *cloudClientDm = (CloudClientDm *) context;
+
+    if ((type == M2MBase::NOTIFICATION) && (status == M2MBase::MESSAGE_STATUS_DELIVERED) &&
+        (cloudClientDm->_deviceObject != NULL)) {
+        for (unsigned int x = 0; x < sizeof(queueFlushOrder) / sizeof(queueFlushOrder[0]); x++) {
+            if (cloudClientDm->_deviceObject->get_resource(queueFlushOrder[x]) == &base) {
+                core_util_critical_section_enter();
+                cloudClientDm->_unackedResources &= ~(1UL << queueFlushOrder[x]);
+                core_util_critical_section_exit();
+            }
+        }
     }
+}
+#endif
+
+// Create the resources for a power source instance.
+bool CloudClientDm::createPowerSourceInstance(PowerSource powerSource, uint16_t instance)
+{
+    bool success;
+
+    // Create the Available Power Source, Voltage and Current for that instance
+    _powerSourceInstance[instance] = powerSource;
+    success = createDeviceObjectResource(M2MDevice::AvailablePowerSources, (int64_t) powerSource, instance) &&
+              createDeviceObjectResource(M2MDevice::PowerSourceVoltage, (int64_t) 0, instance) &&
+              createDeviceObjectResource(M2MDevice::PowerSourceCurrent, (int64_t) 0, instance);
+    // For internal battery, only, add the status and percentage remaining resources
+    if (success && (powerSource == POWER_SOURCE_INTERNAL_BATTERY)) {
+        success = createDeviceObjectResource(M2MDevice::BatteryLevel, (int64_t) 0) &&
+                  createDeviceObjectResource(M2MDevice::BatteryStatus, (int64_t) 0);
+    }
+    queueDeviceObjectResource(M2MDevice::AvailablePowerSources);
+    createHistory(instance);
+    updatePowerPolicy();
 
     return success;
 }
 
-// Set a Device object multi-instance integer resource.
-bool CloudClientDm::setDeviceObjectResource(M2MDevice::DeviceResource resource,
-                                            int64_t value, uint16_t instance)
+// Record the time taken by a plug event.
+void CloudClientDm::recordPlugEvent(int durationUs)
 {
-    bool success = false;
-    M2MDevice *deviceObject = M2MInterfaceFactory::create_device();
+    _stats.numPlugEvents++;
+    _stats.lastPlugUs = durationUs;
+    if (durationUs > _stats.maxPlugUs) {
+        _stats.maxPlugUs = durationUs;
+    }
+}
 
-    if (deviceObject != NULL) {
-        // If we've not started, make sure the resource instance has been created
-        // Note: returning -1 seems like a valid thing to do if the resource's
-        // value happens to be -1.  Thankfully that should not be the case for any
-        // of the resources we are concerned with here.
-        if (!_started) {
-            if (deviceObject->resource_value_int(resource, instance) == -1) {
-                createDeviceObjectResource(resource, value, instance);
+#if CLOUD_CLIENT_DM_READ_CALLBACKS
+// Read callback for the resources set by setDeviceObjectConstString().
+coap_response_code_e CloudClientDm::readConstStringCallback(const M2MResourceBase &resource,
+                                                            uint8_t *buffer,
+                                                            size_t *bufferSize,
+                                                            void *context)
+{
+    CloudClientDm *cloudClientDm = (CloudClientDm *) context;
+    coap_response_code_e response = COAP_RESPONSE_NOT_FOUND;
+    size_t length;
+
+    for (unsigned int x = 0; x < sizeof(cloudClientDm->_constString) / sizeof(cloudClientDm->_constString[0]); x++) {
+        if ((cloudClientDm->_constString[x].resource == &resource) &&
+            (cloudClientDm->_constString[x].value != NULL)) {
+            length = strlen(cloudClientDm->_constString[x].value);
+            if (length > *bufferSize) {
+                length = *bufferSize;
             }
+            memcpy(buffer, cloudClientDm->_constString[x].value, length);
+            *bufferSize = length;
+            response = COAP_RESPONSE_CONTENT;
         }
+    }
+
+    return response;
+}
+#endif
 
-        // Now set the value
-        success = deviceObject->set_resource_value(resource, value, instance);
+// Find the remembered registration latency of an interface.
+int CloudClientDm::findInterfaceLatency(NetworkInterface *interface, bool add)
+{
+    int found = -1;
+
+    for (unsigned int x = 0; (x < sizeof(_interfaceLatency) / sizeof(_interfaceLatency[0])) && (found < 0); x++) {
+        if (_interfaceLatency[x].interface == interface) {
+            found = x;
+        }
+    }
+    for (unsigned int x = 0; (x < sizeof(_interfaceLatency) / sizeof(_interfaceLatency[0])) && (found < 0) && add; x++) {
+        if (_interfaceLatency[x].interface == NULL) {
+            _interfaceLatency[x].interface = interface;
+            _interfaceLatency[x].latencyMs = -1;
+            found = x;
+        }
     }
 
-    if (!success) {
-        printfLog("Error setting integer multi-instance resource \"%s\", instance %d, on the Device object.\n",
-                  deviceObjectResourceString[resource], instance);
+    return found;
+}
+
+// Feed the link quality estimate.
+void CloudClientDm::updateLinkQuality(bool success)
+{
+    int blockSize = _linkQuality.blockSize;
+    bool found = false;
+
+    // Exponentially weighted, each exchange counting for an eighth
+    _linkQuality.qualityPercent = (_linkQuality.qualityPercent * 7 + (success ? 100 : 0) + 4) / 8;
+
+    for (unsigned int x = 0; (x < sizeof(linkQualityTable) / sizeof(linkQualityTable[0])) && !found; x++) {
+        if (_linkQuality.qualityPercent >= linkQualityTable[x].minQualityPercent) {
+            _linkQuality.blockSize = linkQualityTable[x].blockSize;
+            _linkQuality.ackTimeoutSeconds = linkQualityTable[x].ackTimeoutSeconds;
+            _linkQuality.maxRetransmissions = linkQualityTable[x].maxRetransmissions;
+            found = true;
+        }
     }
 
-    return success;
+    if (_linkQuality.blockSize != blockSize) {
+        printfLog("Link quality %d%%, recommended block size now %d byte(s).\n",
+                  _linkQuality.qualityPercent, _linkQuality.blockSize);
+        if (_linkQualityUserCallback) {
+            _linkQualityUserCallback(&_linkQuality);
+        }
+    }
 }
 
-// Set a Device object resource in the config store.
-bool CloudClientDm::setDeviceObjectConfigResource(M2MDevice::DeviceResource resource,
-                                                  std::string str)
+// Measure link throughput, if the measurement window has passed.
+void CloudClientDm::updateLinkThroughput()
 {
-    return setDeviceObjectConfigResource(resource, str.c_str());
+    uint32_t numBytes;
+    int periodMs = _linkQualityTimer.read_ms();
+
+    if (periodMs >= CLOUD_CLIENT_LINK_QUALITY_WINDOW_SECONDS * 1000) {
+        numBytes = _connStats[CONN_STATS_TX_BYTES] + _connStats[CONN_STATS_RX_BYTES];
+        if (_connStatsRunning && (numBytes >= _linkQualityStartBytes)) {
+            _linkQuality.throughputBytesPerSecond = (int) (((uint64_t) (numBytes - _linkQualityStartBytes) * 1000) / periodMs);
+        } else {
+            _linkQuality.throughputBytesPerSecond = -1;
+        }
+        _linkQualityStartBytes = numBytes;
+        _linkQualityTimer.reset();
+    }
 }
 
-// Set a Device object resource in the config store.
-bool CloudClientDm::setDeviceObjectConfigResource(M2MDevice::DeviceResource resource,
-                                                  const char *value)
+// Note the start of an operation, for radio energy accounting.
+void CloudClientDm::setRadioOperation(RadioOperation operation)
 {
-    ccs_status_e ccsStatus;
+    int nowMs = _bootTimer.read_ms();
 
-    delete_config_parameter(deviceObjectResourceString[resource]);
-    ccsStatus = set_config_parameter(deviceObjectResourceString[resource],
-                                     (const uint8_t *) value, strlen(value));
+    core_util_critical_section_enter();
+    _radioOperation = operation;
+    _radioOperationMs = nowMs;
+    core_util_critical_section_exit();
+}
 
-    if (ccsStatus != CCS_STATUS_SUCCESS) {
-        printfLog("Error setting %s (%s).\n",
-                  deviceObjectResourceString[resource],
-                  getCCSErrorString(ccsStatus));
+// Attribute a packet to the current operation.
+void CloudClientDm::countRadio(bool tx, uint32_t bytes)
+{
+    RadioStats *radioStats;
+    RadioOperation operation = RADIO_OP_OTHER;
+    int nowMs = _bootTimer.read_ms();
+    uint64_t nanoJoules;
+
+    core_util_critical_section_enter();
+    // Registration takes as long as it takes, until it fails,
+    // anything else is only blamed for what follows it closely
+    if (_awaitingRegistration && !_registrationFailed) {
+        operation = RADIO_OP_REGISTRATION;
+    } else if (nowMs - _radioOperationMs < CLOUD_CLIENT_RADIO_ATTRIBUTION_MS) {
+        operation = _radioOperation;
     }
+    radioStats = &(_radioStats[operation]);
 
-    return (ccsStatus == CCS_STATUS_SUCCESS);
+    if (tx) {
+        radioStats->txBytes += bytes;
+        radioStats->txPackets++;
+        nanoJoules = (uint64_t) bytes * _radioCosts.txNanoJoulesPerByte;
+    } else {
+        radioStats->rxBytes += bytes;
+        radioStats->rxPackets++;
+        nanoJoules = (uint64_t) bytes * _radioCosts.rxNanoJoulesPerByte;
+    }
+    radioStats->energyMicroJoules += nanoJoules / 1000;
+
+    // A packet after the tail has expired wakes the radio up, which
+    // keeps it active for the tail; one before just extends the tail
+    if ((_radioLastPacketMs < 0) || (nowMs - _radioLastPacketMs > _radioCosts.tailMs)) {
+        radioStats->numWakeups++;
+        radioStats->activeMs += _radioCosts.tailMs;
+        radioStats->energyMicroJoules += _radioCosts.microJoulesPerWakeup;
+    } else {
+        radioStats->activeMs += nowMs - _radioLastPacketMs;
+    }
+    _radioLastPacketMs = nowMs;
+    core_util_critical_section_exit();
 }
 
-// Get the error string for an Mbed Client error code.
-const char *CloudClientDm::getMbedClientErrorString(MbedCloudClient::Error errorCode)
+// Pass an event to the subscribers that want it.
+void CloudClientDm::publishEvent(Event event, int parameter)
 {
-    const char *errorString = NULL;
+    Callback<void(Event, int)> callback;
+    EventQueue *queue;
+    bool wanted;
+
+    for (unsigned int x = 0; x < sizeof(_subscriber) / sizeof(_subscriber[0]); x++) {
+        // The table may be changed by the application's thread, so
+        // take a copy of the entry rather than call through it
+        core_util_critical_section_enter();
+        wanted = ((_subscriber[x].eventMask & event) != 0);
+        callback = _subscriber[x].callback;
+        queue = _subscriber[x].queue;
+        core_util_critical_section_exit();
+        if (wanted && callback) {
+            if (queue != NULL) {
+                // An enqueue only, the handler runs in the queue's thread
+                if (queue->call(callback, event, parameter) == 0) {
+                    _stats.numEventsDropped++;
+                }
+            } else {
+                callback(event, parameter);
+            }
+        }
+    }
+}
 
-    switch (errorCode) {
-        case MbedCloudClient::ConnectErrorNone:
-            errorString = "MbedCloudClient::ConnectErrorNone";
-            break;
-        case MbedCloudClient::ConnectAlreadyExists:
-            errorString = "MbedCloudClient::ConnectAlreadyExists";
-            break;
-        case MbedCloudClient::ConnectBootstrapFailed:
-            errorString = "MbedCloudClient::ConnectBootstrapFailed";
-            break;
-        case MbedCloudClient::ConnectInvalidParameters:
-            errorString = "MbedCloudClient::ConnectInvalidParameters";
-            break;
-        case MbedCloudClient::ConnectNotRegistered:
-            errorString = "MbedCloudClient::ConnectNotRegistered";
-            break;
-        case MbedCloudClient::ConnectTimeout:
-            errorString = "MbedCloudClient::ConnectTimeout";
-            break;
-        case MbedCloudClient::ConnectNetworkError:
-            errorString = "MbedCloudClient::ConnectNetworkError";
-            break;
-        case MbedCloudClient::ConnectResponseParseFailed:
-            errorString = "MbedCloudClient::ConnectResponseParseFailed";
-            break;
-        case MbedCloudClient::ConnectUnknownError:
-            errorString = "MbedCloudClient::ConnectUnknownError";
-            break;
-        case MbedCloudClient::ConnectMemoryConnectFail:
-            errorString = "MbedCloudClient::ConnectMemoryConnectFail";
-            break;
-        case MbedCloudClient::ConnectNotAllowed:
-            errorString = "MbedCloudClient::ConnectNotAllowed";
-            break;
-        case MbedCloudClient::ConnectSecureConnectionFailed:
-            errorString = "MbedCloudClient::ConnectSecureConnectionFailed";
-            break;
-        case MbedCloudClient::ConnectDnsResolvingFailed:
-            errorString = "MbedCloudClient::ConnectDnsResolvingFailed";
-            break;
-#ifdef MBED_CLOUD_CLIENT_SUPPORT_UPDATE
-        case MbedCloudClient::UpdateWarningCertificateNotFound:
-            errorString = "MbedCloudClient::UpdateWarningCertificateNotFound";
-            break;
-        case MbedCloudClient::UpdateWarningIdentityNotFound:
-            errorString = "MbedCloudClient::UpdateWarningIdentityNotFound";
-            break;
-        case MbedCloudClient::UpdateWarningCertificateInvalid:
-            errorString = "MbedCloudClient::UpdateWarningCertificateInvalid";
-            break;
-        case MbedCloudClient::UpdateWarningSignatureInvalid:
-            errorString = "MbedCloudClient::UpdateWarningSignatureInvalid";
-            break;
-        case MbedCloudClient::UpdateWarningVendorMismatch:
-            errorString = "MbedCloudClient::UpdateWarningVendorMismatch";
-            break;
-        case MbedCloudClient::UpdateWarningClassMismatch:
-            errorString = "MbedCloudClient::UpdateWarningClassMismatch";
-            break;
-        case MbedCloudClient::UpdateWarningDeviceMismatch:
-            errorString = "MbedCloudClient::UpdateWarningDeviceMismatch";
-            break;
-        case MbedCloudClient::UpdateWarningURINotFound:
-            errorString = "MbedCloudClient::UpdateWarningURINotFound";
+// Work out the key of a write handler.
+uint64_t CloudClientDm::writeHandlerKey(uint16_t objectId, int instanceId, int resourceId)
+{
+    // 0xFFFF, not a valid ID, stands for "all"
+    return ((uint64_t) objectId << 32) |
+           ((uint64_t) (instanceId < 0 ? 0xFFFF : instanceId & 0xFFFF) << 16) |
+           (uint64_t) (resourceId < 0 ? 0xFFFF : resourceId & 0xFFFF);
+}
+
+// Find the entry for a key in the table of write handlers.
+int CloudClientDm::findWriteHandler(uint64_t key, bool add)
+{
+    const unsigned int mask = CLOUD_CLIENT_WRITE_HANDLER_TABLE_SIZE - 1;
+    unsigned int index = (unsigned int) ((key * 0x9E3779B97F4A7C15ULL) >> 32) & mask;
+    int found = -1;
+    int removed = -1;
+    bool endOfProbe = false;
+
+    // Linear probe; the entry of a removed handler stays in use,
+    // so that a probe sequence is never broken, until an add
+    // takes it over
+    for (unsigned int x = 0; (x < CLOUD_CLIENT_WRITE_HANDLER_TABLE_SIZE) && (found < 0) && !endOfProbe; x++) {
+        if (!_writeHandler[index].used) {
+            endOfProbe = true;
+        } else if (_writeHandler[index].key == key) {
+            found = index;
+        } else {
+            if ((removed < 0) && !_writeHandler[index].handler) {
+                removed = index;
+            }
+            index = (index + 1) & mask;
+        }
+    }
+
+    if ((found < 0) && add) {
+        if (removed >= 0) {
+            found = removed;
+        } else if (endOfProbe) {
+            found = index;
+            _writeHandler[index].used = true;
+        }
+        if (found >= 0) {
+            _writeHandler[found].key = key;
+        }
+    }
+
+    return found;
+}
+
+// Find the most specific write handler for a resource.
+int CloudClientDm::findWriteHandler(uint16_t objectId, int instanceId, int resourceId)
+{
+    int x = findWriteHandler(writeHandlerKey(objectId, instanceId, resourceId), false);
+
+    if ((x < 0) || !_writeHandler[x].handler) {
+        x = findWriteHandler(writeHandlerKey(objectId, instanceId, -1), false);
+    }
+    if ((x < 0) || !_writeHandler[x].handler) {
+        x = findWriteHandler(writeHandlerKey(objectId, -1, -1), false);
+    }
+    if ((x >= 0) && !_writeHandler[x].handler) {
+        x = -1;
+    }
+
+    return x;
+}
+
+// Bind the write handlers to the writable resources they cover.
+void CloudClientDm::bindWriteHandlers()
+{
+    WriteBinding *binding;
+    M2MResource *resource;
+    int32_t objectId;
+    int x;
+
+    for (unsigned int o = 0; o < _objectList.size(); o++) {
+        objectId = _objectList[o]->name_id();
+        const M2MObjectInstanceList &instances = _objectList[o]->instances();
+        for (unsigned int i = 0; (objectId >= 0) && (i < instances.size()); i++) {
+            const M2MResourceList &resources = instances[i]->resources();
+            for (unsigned int r = 0; r < resources.size(); r++) {
+                resource = resources[r];
+                if ((resource->operation() & M2MBase::PUT_ALLOWED) != 0) {
+                    x = findWriteHandler((uint16_t) objectId, instances[i]->instance_id(),
+                                         resource->name_id());
+                    binding = _writeBindingList;
+                    while ((binding != NULL) && (binding->_base != resource)) {
+                        binding = binding->_next;
+                    }
+                    // Once bound a resource stays bound, falling back
+                    // to the global callback if its handler goes
+                    if ((binding == NULL) && (x >= 0) && !resource->is_value_updated_function_set()) {
+                        binding = new WriteBinding(this, resource);
+                        resource->set_value_updated_function(value_updated_callback(binding,
+                                                                                    &WriteBinding::valueUpdated));
+                        binding->_next = _writeBindingList;
+                        _writeBindingList = binding;
+                    }
+                    if (binding != NULL) {
+                        binding->_handler = x;
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Called by the Mbed Cloud Client when a resource with a write handler is written.
+void CloudClientDm::WriteBinding::valueUpdated(const char *name)
+{
+    (void) name;
+
+    if ((_handler >= 0) && _cloudClientDm->_writeHandler[_handler].handler) {
+        _cloudClientDm->_writeHandler[_handler].handler(_base);
+    } else if (_cloudClientDm->_globalUpdateCallback != NULL) {
+        _cloudClientDm->_globalUpdateCallback->value_updated(_base, M2MBase::RESOURCE);
+    }
+}
+
+// Get the instance ID of a power source.
+int CloudClientDm::getPowerSourceInstance(PowerSource powerSource)
+{
+    int instance = -1;
+
+    for (unsigned int x = 0; (x < sizeof(_powerSourceInstance) / sizeof (_powerSourceInstance[0])) && (instance < 0); x++) {
+        if (_powerSourceInstance[x] == powerSource) {
+            instance = x;
+        }
+    }
+
+    return instance;
+}
+
+// Start keeping history for a power source instance, if enabled.
+void CloudClientDm::createHistory(uint16_t instance)
+{
+    HeapMark heapMark;
+
+    if (_historyEnabled && (_memoryShedLevel < MEMORY_SHED_HISTORY) &&
+        (_history[instance] == NULL)) {
+        heapTagBegin(&heapMark);
+        _history[instance] = (History *) malloc(sizeof(History));
+        heapTagEnd(HEAP_TAG_BUFFERS, &heapMark);
+        if (_history[instance] != NULL) {
+            memset(_history[instance], 0, sizeof(History));
+        } else {
+            printfLogError("Error allocating history for power source instance %d.\n", instance);
+        }
+    }
+}
+
+// Stop keeping history for a power source instance.
+void CloudClientDm::deleteHistory(uint16_t instance)
+{
+    HeapMark heapMark;
+
+    if (_history[instance] != NULL) {
+        heapTagBegin(&heapMark);
+        free(_history[instance]);
+        heapTagEnd(HEAP_TAG_BUFFERS, &heapMark);
+        _history[instance] = NULL;
+        _historyChanged = true;
+    }
+}
+
+// Add a sample to the history of a power source instance.
+void CloudClientDm::addHistorySample(uint16_t instance, unsigned int kind, int value)
+{
+    History *history = _history[instance];
+    HistoryChunk *chunk;
+    uint32_t nowMs;
+
+    if (history != NULL) {
+        nowMs = _historyTimer.read_ms();
+        chunk = &(history->chunk[history->active]);
+
+        // A sample is at most two five-byte varints; if there's no
+        // room, move on to the other chunk, spilling it first if required
+        if ((unsigned int) chunk->length + 10 > sizeof(chunk->data)) {
+            history->active ^= 1;
+            chunk = &(history->chunk[history->active]);
+            if (_historySpill && (chunk->length > 0)) {
+                spillHistoryChunk(instance, chunk);
+            }
+            chunk->length = 0;
+        }
+
+        // A chunk starts from zero
+        if (chunk->length == 0) {
+            memset(chunk->lastValue, 0, sizeof(chunk->lastValue));
+            chunk->startTimeMs = nowMs;
+            chunk->lastTimeMs = nowMs;
+        }
+
+        chunk->length += encodeVarint(chunk->data + chunk->length,
+                                      ((nowMs - chunk->lastTimeMs) << 2) | kind);
+        chunk->length += encodeVarint(chunk->data + chunk->length,
+                                      zigzag(value - chunk->lastValue[kind]));
+        chunk->lastValue[kind] = value;
+        chunk->lastTimeMs = nowMs;
+        _historyChanged = true;
+    }
+}
+
+// Serialise a chunk of history.
+int CloudClientDm::serialiseHistoryChunk(uint8_t *buffer, uint16_t instance,
+                                         const HistoryChunk *chunk)
+{
+    buffer[0] = (uint8_t) instance;
+    buffer[1] = (uint8_t) _powerSourceInstance[instance];
+    buffer[2] = (uint8_t) chunk->length;
+    buffer[3] = (uint8_t) (chunk->length >> 8);
+    buffer[4] = (uint8_t) chunk->startTimeMs;
+    buffer[5] = (uint8_t) (chunk->startTimeMs >> 8);
+    buffer[6] = (uint8_t) (chunk->startTimeMs >> 16);
+    buffer[7] = (uint8_t) (chunk->startTimeMs >> 24);
+    memcpy(buffer + 8, chunk->data, chunk->length);
+
+    return chunk->length + 8;
+}
+
+// Write a chunk of history to Cloud Client storage.
+void CloudClientDm::spillHistoryChunk(uint16_t instance, const HistoryChunk *chunk)
+{
+    uint8_t buffer[CLOUD_CLIENT_HISTORY_CHUNK_SIZE + 8];
+    char key[24];
+    ccs_status_e ccsStatus;
+    int length;
+
+    snprintf(key, sizeof(key), "%s%d", historyKeyPrefix, instance);
+    length = serialiseHistoryChunk(buffer, instance, chunk);
+    delete_config_parameter(key);
+    ccsStatus = set_config_parameter(key, buffer, length);
+    if (ccsStatus != CCS_STATUS_SUCCESS) {
+        printfLogError("Error spilling history for power source instance %d (%s).\n",
+                       instance, getCCSErrorString(ccsStatus));
+    }
+}
+
+// Refresh the history resource if the history has changed.
+void CloudClientDm::updateDeviceObjectHistory()
+{
+    uint8_t *buffer;
+    uint8_t *p;
+    History *history;
+    char key[24];
+    size_t length;
+    unsigned int numHistories = 0;
+    HeapMark heapMark;
+
+    heapTagBegin(&heapMark);
+    if ((_historyResource != NULL) && _historyChanged) {
+        _historyChanged = false;
+        for (unsigned int x = 0; x < sizeof(_history) / sizeof(_history[0]); x++) {
+            if (_history[x] != NULL) {
+                numHistories++;
+            }
+        }
+
+        // Room for three chunks per power source: spilled, older and newer
+        buffer = (uint8_t *) malloc(numHistories * 3 * (CLOUD_CLIENT_HISTORY_CHUNK_SIZE + 8) + 1);
+        if (buffer != NULL) {
+            p = buffer;
+            for (uint16_t x = 0; x < sizeof(_history) / sizeof(_history[0]); x++) {
+                history = _history[x];
+                if (history != NULL) {
+                    if (_historySpill) {
+                        snprintf(key, sizeof(key), "%s%d", historyKeyPrefix, x);
+                        length = 0;
+                        if (get_config_parameter(key, p, CLOUD_CLIENT_HISTORY_CHUNK_SIZE + 8,
+                                                 &length) == CCS_STATUS_SUCCESS) {
+                            p += length;
+                        }
+                    }
+                    if (history->chunk[history->active ^ 1].length > 0) {
+                        p += serialiseHistoryChunk(p, x, &(history->chunk[history->active ^ 1]));
+                    }
+                    if (history->chunk[history->active].length > 0) {
+                        p += serialiseHistoryChunk(p, x, &(history->chunk[history->active]));
+                    }
+                }
+            }
+            _historyResource->set_value(buffer, p - buffer);
+            setRadioOperation(RADIO_OP_CUSTOM_OBJECT);
+            free(buffer);
+        } else {
+            _historyChanged = true;
+            printfLogError("Error allocating buffer for history.\n");
+        }
+    }
+    heapTagEnd(HEAP_TAG_BUFFERS, &heapMark);
+}
+
+// Choose the power policy table entry that applies now.
+void CloudClientDm::updatePowerPolicy()
+{
+    const PowerPolicy *powerPolicy = NULL;
+    bool externalPower = false;
+    int64_t batteryLevel;
+    int64_t batteryStatus;
+
+    if ((_powerPolicyTable != NULL) && (_powerPolicyNumEntries > 0) && (_deviceObject != NULL)) {
+        for (unsigned int x = 0; x < sizeof(_powerSourceInstance) / sizeof (_powerSourceInstance[0]); x++) {
+            switch (_powerSourceInstance[x]) {
+                case POWER_SOURCE_DC:
+                case POWER_SOURCE_POE:
+                case POWER_SOURCE_USB:
+                case POWER_SOURCE_MAINS:
+                    externalPower = true;
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        batteryLevel = 100;
+        batteryStatus = BATTERY_STATUS_UNKNOWN;
+        if (existsDeviceObjectPowerSource(POWER_SOURCE_INTERNAL_BATTERY)) {
+            batteryLevel = _deviceObject->resource_value_int(M2MDevice::BatteryLevel);
+            batteryStatus = _deviceObject->resource_value_int(M2MDevice::BatteryStatus);
+        }
+
+        if (externalPower || (batteryStatus == BATTERY_STATUS_CHARGING) ||
+            (batteryStatus == BATTERY_STATUS_CHARGING_COMPLETE)) {
+            powerPolicy = &(_powerPolicyTable[0]);
+        } else if (batteryStatus == BATTERY_STATUS_LOW_BATTERY) {
+            powerPolicy = &(_powerPolicyTable[_powerPolicyNumEntries - 1]);
+        } else {
+            for (int x = 0; (x < _powerPolicyNumEntries) && (powerPolicy == NULL); x++) {
+                if (batteryLevel >= _powerPolicyTable[x].minBatteryLevelPercent) {
+                    powerPolicy = &(_powerPolicyTable[x]);
+                }
+            }
+            if (powerPolicy == NULL) {
+                powerPolicy = &(_powerPolicyTable[_powerPolicyNumEntries - 1]);
+            }
+        }
+    }
+
+    if (powerPolicy != _powerPolicy) {
+        _powerPolicy = powerPolicy;
+        if (_powerPolicy != NULL) {
+            printfLog("Power policy now: keep-alive %d s, report interval %d s, deadband %d mV/%d mA.\n",
+                      _powerPolicy->keepAliveIntervalSeconds, _powerPolicy->minReportIntervalSeconds,
+                      _powerPolicy->voltageDeadbandMV, _powerPolicy->currentDeadbandMA);
+        }
+        // Anything held back under the old policy goes now
+        flushPowerSourceResources(true);
+    }
+}
+
+// Update a power source Voltage or Current resource, subject to the power policy.
+bool CloudClientDm::setPowerSourceResource(M2MDevice::DeviceResource resource,
+                                           int value, uint16_t instance)
+{
+    bool voltage = (resource == M2MDevice::PowerSourceVoltage);
+    uint32_t pendingBit = 1UL << (instance * 2 + (voltage ? 0 : 1));
+    int *lastReportMs = &(_powerReportMs[instance][voltage ? 0 : 1]);
+    int nowMs = _bootTimer.read_ms();
+    int deadband;
+    int64_t difference;
+    bool success = true;
+
+    // Critical updates aren't subject to the power policy
+    if (!_started || (_powerPolicy == NULL) ||
+        (_updatePriority[resource] == UPDATE_PRIORITY_CRITICAL)) {
+        _pendingPowerSourceResources &= ~pendingBit;
+        success = setDeviceObjectResource(resource, (int64_t) value, instance);
+        *lastReportMs = nowMs;
+    } else {
+        deadband = voltage ? _powerPolicy->voltageDeadbandMV : _powerPolicy->currentDeadbandMA;
+        difference = value - _deviceObject->resource_value_int(resource, instance);
+        if (difference == 0) {
+            // Back where it was, nothing to tell
+            _pendingPowerSourceResources &= ~pendingBit;
+        } else if (((difference >= deadband) || (difference <= -deadband)) &&
+                   (nowMs - *lastReportMs >= _powerPolicy->minReportIntervalSeconds * 1000)) {
+            _pendingPowerSourceResources &= ~pendingBit;
+            success = setDeviceObjectResource(resource, (int64_t) value, instance);
+            *lastReportMs = nowMs;
+        } else {
+            // Hold it back until the report interval of this
+            // resource has passed; a change inside the deadband
+            // isn't worth a report of its own, but nor should the
+            // server be left with a stale value for ever
+            if (voltage) {
+                _pendingVoltageMV[instance] = value;
+            } else {
+                _pendingCurrentMA[instance] = value;
+            }
+            _pendingPowerSourceResources |= pendingBit;
+        }
+    }
+
+    return success;
+}
+
+// Write power source values held back by the power policy.
+void CloudClientDm::flushPowerSourceResources(bool force)
+{
+    int nowMs = _bootTimer.read_ms();
+    uint32_t bit;
+    bool due;
+
+    // Each power source Voltage and Current has its own report interval
+    for (uint16_t x = 0; (x < sizeof(_powerSourceInstance) / sizeof (_powerSourceInstance[0])) &&
+                         (_pendingPowerSourceResources != 0); x++) {
+        for (unsigned int y = 0; y < 2; y++) {
+            bit = 1UL << (x * 2 + y);
+            due = force || (_powerPolicy == NULL) ||
+                  (nowMs - _powerReportMs[x][y] >= _powerPolicy->minReportIntervalSeconds * 1000);
+            if ((_pendingPowerSourceResources & bit) && due) {
+                _pendingPowerSourceResources &= ~bit;
+                if (_powerSourceInstance[x] != POWER_SOURCE_UNUSED) {
+                    if (y == 0) {
+                        setDeviceObjectResource(M2MDevice::PowerSourceVoltage, (int64_t) _pendingVoltageMV[x], x);
+                    } else {
+                        setDeviceObjectResource(M2MDevice::PowerSourceCurrent, (int64_t) _pendingCurrentMA[x], x);
+                    }
+                    _powerReportMs[x][y] = nowMs;
+                }
+            }
+        }
+    }
+}
+
+// The body of the thread that brings up the network interface.
+void CloudClientDm::attachNetworkThread()
+{
+    Timer timer;
+    nsapi_error_t status;
+
+    timer.start();
+    status = _attachInterface->connect();
+    _stats.attachMs = timer.read_ms();
+    // Someone may have brought the interface up already
+    if ((status == NSAPI_ERROR_OK) || (status == NSAPI_ERROR_IS_CONNECTED)) {
+        printfLog("Network attached in %d ms.\n", _stats.attachMs);
+        _attached = true;
+        connectAfterAttach();
+    } else {
+        printfLogError("Error attaching to the network (%d).\n", status);
+        publishEvent(EVENT_ERROR, status);
+    }
+}
+
+// Call connect() once the network is attached and we have been started.
+void CloudClientDm::connectAfterAttach()
+{
+    bool doConnect = false;
+
+    // Called from both the attach thread and start(),
+    // make sure only one of them connects
+    core_util_critical_section_enter();
+    if (_attached && _started && !_attachConnected) {
+        _attachConnected = true;
+        doConnect = true;
+    }
+    core_util_critical_section_exit();
+
+    // No-one is waiting on a return value, so tell the subscribers
+    if (doConnect && !connect(_attachInterface)) {
+        printfLogError("Error connecting after network attach.\n");
+        publishEvent(EVENT_ERROR, MbedCloudClient::ConnectUnknownError);
+    }
+}
+
+// Encode one resource as a SenML-CBOR record.
+int CloudClientDm::encodeBatchRecord(uint8_t *buffer, M2MResourceInstance *resource)
+{
+    // SenML labels (RFC 8428, section 6)
+    const int labelName = 0;
+    const int labelValue = 2;
+    const int labelStringValue = 3;
+    const int labelBooleanValue = 4;
+    const int labelDataValue = 8;
+    const char *path = resource->uri_path();
+    uint8_t *value = resource->value();
+    uint32_t valueLength = resource->value_length();
+    int length = 0;
+
+    // A map of two pairs: the name and the value
+    length += encodeCborHead(buffer, 5, 2);
+    length += encodeCborInt(offsetOf(buffer, length), labelName);
+    length += encodeCborString(offsetOf(buffer, length), 3, (const uint8_t *) path, strlen(path));
+    switch (resource->resource_instance_type()) {
+        case M2MResourceInstance::INTEGER:
+        case M2MResourceInstance::TIME:
+            length += encodeCborInt(offsetOf(buffer, length), labelValue);
+            length += encodeCborInt(offsetOf(buffer, length), resource->get_value_int());
             break;
-        case MbedCloudClient::UpdateWarningRollbackProtection:
-            errorString = "MbedCloudClient::UpdateWarningRollbackProtection";
+        case M2MResourceInstance::BOOLEAN:
+            // Simple values 21 and 20 are true and false
+            length += encodeCborInt(offsetOf(buffer, length), labelBooleanValue);
+            length += encodeCborHead(offsetOf(buffer, length), 7, resource->get_value_int() != 0 ? 21 : 20);
             break;
-        case MbedCloudClient::UpdateWarningUnknown:
-            errorString = "MbedCloudClient::UpdateWarningUnknown";
+        case M2MResourceInstance::FLOAT:
+            length += encodeCborInt(offsetOf(buffer, length), labelValue);
+            length += encodeCborFloat(offsetOf(buffer, length),
+                                      strtof(resource->get_value_string().c_str(), NULL));
             break;
-        case MbedCloudClient::UpdateErrorWriteToStorage:
-            errorString = "MbedCloudClient::UpdateErrorWriteToStorage";
+        case M2MResourceInstance::OPAQUE:
+            length += encodeCborInt(offsetOf(buffer, length), labelDataValue);
+            length += encodeCborString(offsetOf(buffer, length), 2, value, valueLength);
             break;
-#endif
         default:
-            errorString = "UNKNOWN";
+            length += encodeCborInt(offsetOf(buffer, length), labelStringValue);
+            length += encodeCborString(offsetOf(buffer, length), 3, value, valueLength);
             break;
     }
 
-    return errorString;
+    return length;
+}
+
+// Set a Device object resource from a std::string.
+bool CloudClientDm::setDeviceObjectResource(M2MDevice::DeviceResource resource,
+                                            const std::string &str)
+{
+    bool success = false;
+    HeapMark heapMark;
+
+    heapTagBegin(&heapMark);
+    if (_deviceObject != NULL) {
+        // If we've not started, make sure the resource has been created;
+        // that sets the value too, no need to copy it in twice
+        if (!_started && !_deviceObject->is_resource_present(resource)) {
+            success = createDeviceObjectResource(resource, str.c_str());
+        } else {
+            success = _cloudClient.set_device_resource_value(resource, str);
+        }
+    }
+
+    if (success) {
+        _stats.numUpdates++;
+        queueDeviceObjectResource(resource);
+    } else {
+        _stats.numUpdateFailures++;
+        printfLogError("Error setting %s.\n", deviceObjectResourceString[resource]);
+    }
+
+    heapTagEnd(HEAP_TAG_STRINGS, &heapMark);
+    return success;
+}
+
+// Set a Device object resource.
+bool CloudClientDm::setDeviceObjectResource(M2MDevice::DeviceResource resource,
+                                            const char *value)
+{
+    return setDeviceObjectResource(resource, std::string(value));
+}
+
+// Set a Device object resource.
+bool CloudClientDm::setDeviceObjectResource(M2MDevice::DeviceResource resource,
+                                            int64_t value)
+{
+    bool success = false;
+    bool deferred = false;
+
+    if (_deviceObject != NULL) {
+        // If we've not started, make sure the resource instance has been created
+        if ((_deviceObject != NULL) && !_deviceObject->is_resource_present(resource)) {
+            createDeviceObjectResource(resource, value);
+        }
+
+        // Now set the value, unless it is bulk and can wait
+        if (_started && (_updatePriority[resource] == UPDATE_PRIORITY_BULK)) {
+            deferred = deferUpdate(resource, -1, value);
+        }
+        success = deferred || _deviceObject->set_resource_value(resource, value);
+    }
+
+    if (success) {
+        // A deferred update is counted when it is written
+        if (!deferred) {
+            _stats.numUpdates++;
+            queueDeviceObjectResource(resource);
+        }
+    } else {
+        _stats.numUpdateFailures++;
+        printfLogError("Error setting integer resource \"%s\" on the Device object.\n",
+                       deviceObjectResourceString[resource]);
+    }
+
+    return success;
+}
+
+// Set a Device object multi-instance integer resource.
+bool CloudClientDm::setDeviceObjectResource(M2MDevice::DeviceResource resource,
+                                            int64_t value, uint16_t instance)
+{
+    bool success = false;
+    bool deferred = false;
+
+    if (_deviceObject != NULL) {
+        // If we've not started, make sure the resource instance has been created
+        // Note: returning -1 seems like a valid thing to do if the resource's
+        // value happens to be -1.  Thankfully that should not be the case for any
+        // of the resources we are concerned with here.
+        if (!_started) {
+            if (_deviceObject->resource_value_int(resource, instance) == -1) {
+                createDeviceObjectResource(resource, value, instance);
+            }
+        }
+
+        // Now set the value, unless it is bulk and can wait
+        if (_started && (_updatePriority[resource] == UPDATE_PRIORITY_BULK)) {
+            deferred = deferUpdate(resource, instance, value);
+        }
+        success = deferred || _deviceObject->set_resource_value(resource, value, instance);
+    }
+
+    if (success) {
+        // A deferred update is counted when it is written
+        if (!deferred) {
+            _stats.numUpdates++;
+            queueDeviceObjectResource(resource);
+        }
+    } else {
+        _stats.numUpdateFailures++;
+        printfLogError("Error setting integer multi-instance resource \"%s\", instance %d, on the Device object.\n",
+                       deviceObjectResourceString[resource], instance);
+    }
+
+    return success;
+}
+
+// Set a Device object resource in the config store.
+bool CloudClientDm::setDeviceObjectConfigResource(M2MDevice::DeviceResource resource,
+                                                  std::string str)
+{
+    return setDeviceObjectConfigResource(resource, str.c_str());
+}
+
+// Set a Device object resource in the config store.
+bool CloudClientDm::setDeviceObjectConfigResource(M2MDevice::DeviceResource resource,
+                                                  const char *value)
+{
+    ccs_status_e ccsStatus;
+
+    delete_config_parameter(deviceObjectResourceString[resource]);
+    ccsStatus = set_config_parameter(deviceObjectResourceString[resource],
+                                     (const uint8_t *) value, strlen(value));
+
+    if (ccsStatus == CCS_STATUS_SUCCESS) {
+        _stats.numUpdates++;
+    } else {
+        _stats.numUpdateFailures++;
+        printfLogError("Error setting %s (%s).\n",
+                       deviceObjectResourceString[resource],
+                       getCCSErrorString(ccsStatus));
+    }
+
+    return (ccsStatus == CCS_STATUS_SUCCESS);
+}
+
+// Create an object with instance 0, owned by us, and add it to the client.
+M2MObjectInstance *CloudClientDm::createObject(const char *name)
+{
+    M2MObject *object;
+    M2MObjectInstance *objectInstance = NULL;
+    HeapMark heapMark;
+
+    heapTagBegin(&heapMark);
+    object = M2MInterfaceFactory::create_object(name);
+    if (object != NULL) {
+        objectInstance = object->create_object_instance();
+        if (objectInstance != NULL) {
+            _ownObjectList.push_back(object);
+            addObject(object);
+        } else {
+            delete object;
+        }
+    }
+
+    if (objectInstance == NULL) {
+        printfLogError("Error creating object \"%s\".\n", name);
+    }
+
+    heapTagEnd(HEAP_TAG_OBJECTS, &heapMark);
+    return objectInstance;
+}
+
+// Create a resource on an object instance.
+M2MResource *CloudClientDm::createResource(M2MObjectInstance *objectInstance,
+                                           const char *name,
+                                           M2MResourceInstance::ResourceType type,
+                                           M2MBase::Operation operation)
+{
+    M2MResource *resource = NULL;
+    HeapMark heapMark;
+
+    heapTagBegin(&heapMark);
+    if (objectInstance != NULL) {
+        resource = objectInstance->create_dynamic_resource(name, "", type,
+                                                           (operation & M2MBase::GET_ALLOWED) != 0);
+    }
+
+    if (resource != NULL) {
+        resource->set_operation(operation);
+    } else {
+        printfLogError("Error creating resource \"%s\".\n", name);
+    }
+
+    heapTagEnd(HEAP_TAG_RESOURCES, &heapMark);
+    return resource;
+}
+
+// Create instance 0 of a multi-instance resource on an object instance.
+M2MResourceInstance *CloudClientDm::createResourceInstance(M2MObjectInstance *objectInstance,
+                                                           const char *name,
+                                                           M2MResourceInstance::ResourceType type)
+{
+    M2MResourceInstance *resourceInstance = NULL;
+    M2MResource *resource;
+    HeapMark heapMark;
+
+    heapTagBegin(&heapMark);
+    if (objectInstance != NULL) {
+        resourceInstance = objectInstance->create_dynamic_resource_instance(name, "", type, true, 0);
+        resource = objectInstance->resource(name);
+        if (resource != NULL) {
+            resource->set_operation(M2MBase::GET_ALLOWED);
+        }
+    }
+
+    if (resourceInstance == NULL) {
+        printfLogError("Error creating resource instance \"%s\".\n", name);
+    }
+
+    heapTagEnd(HEAP_TAG_RESOURCES, &heapMark);
+    return resourceInstance;
+}
+
+// Handler for a firmware update authorization request.
+void CloudClientDm::updateAuthorizeHandler(int32_t request)
+{
+    CloudClientDm *instance = _updateInstance;
+
+    if (instance != NULL) {
+        core_util_critical_section_enter();
+        instance->_updateRequest = request;
+        instance->_updatePending = true;
+        core_util_critical_section_exit();
+        instance->_updateProgressPercent = -1;
+        instance->checkUpdatePending();
+    }
+}
+
+// Handler for firmware update download progress.
+void CloudClientDm::updateProgressHandler(uint32_t progress, uint32_t total)
+{
+    CloudClientDm *instance = _updateInstance;
+
+    if (instance != NULL) {
+        instance->updateProgress(progress, total);
+    }
+}
+
+// Act on firmware update download progress, throttled to
+// whole-percent steps.
+void CloudClientDm::updateProgress(uint32_t progress, uint32_t total)
+{
+    int percent = 0;
+
+    // Each block of the download renews the attribution
+    setRadioOperation(RADIO_OP_FIRMWARE);
+    if (total > 0) {
+        percent = (int) (((uint64_t) progress * 100) / total);
+    }
+
+    if (percent != _updateProgressPercent) {
+        _updateProgressPercent = percent;
+        if (_updateProgressUserCallback) {
+            _updateProgressUserCallback(percent);
+        }
+    }
+}
+
+// Check whether a firmware update step is allowed by the update policy.
+bool CloudClientDm::updateAllowed(int32_t request)
+{
+    bool allowed = true;
+
+    if ((_updateMinBatteryLevelPercent >= 0) && (_deviceObject != NULL) &&
+        existsDeviceObjectPowerSource(POWER_SOURCE_INTERNAL_BATTERY) &&
+        (_deviceObject->resource_value_int(M2MDevice::BatteryLevel) < _updateMinBatteryLevelPercent)) {
+        allowed = false;
+    }
+
+#if defined(MBED_CLOUD_CLIENT_SUPPORT_UPDATE) && defined(MBED_HEAP_STATS_ENABLED)
+    if ((_updateMinHeapFreeBytes >= 0) && (request == MbedCloudClient::UpdateRequestDownload)) {
+        mbed_stats_heap_t heapStats;
+
+        mbed_stats_heap_get(&heapStats);
+        if ((int) (heapStats.reserved_size - heapStats.current_size) < _updateMinHeapFreeBytes) {
+            allowed = false;
+        }
+    }
+#endif
+
+    if (allowed && _updateRequireIdle && !_updateIdle) {
+        allowed = false;
+    }
+
+    if (allowed && _updatePolicyCallback) {
+        allowed = _updatePolicyCallback(request);
+    }
+
+    return allowed;
+}
+
+// Authorize the pending firmware update step when the policy allows it.
+void CloudClientDm::checkUpdatePending()
+{
+#ifdef MBED_CLOUD_CLIENT_SUPPORT_UPDATE
+    int32_t request;
+    bool pending;
+    bool claimed = false;
+
+    core_util_critical_section_enter();
+    request = _updateRequest;
+    pending = _updatePending;
+    core_util_critical_section_exit();
+
+    // This is called from both the application's thread and the
+    // Mbed Cloud Client's, so claim the request (updateAllowed() may
+    // call the application, hence not under the lock) before acting
+    // on it, so that it is only authorized once
+    if (pending && updateAllowed(request)) {
+        core_util_critical_section_enter();
+        if (_updatePending && (_updateRequest == request)) {
+            _updatePending = false;
+            claimed = true;
+        }
+        core_util_critical_section_exit();
+        if (claimed) {
+            if (request == MbedCloudClient::UpdateRequestDownload) {
+                printfLog("Firmware update download authorized.\n");
+            } else {
+                printfLog("Firmware update install authorized.\n");
+            }
+            _cloudClient.update_authorize(request);
+        }
+    }
+#endif
+}
+
+// Copy the connectivity statistics counters into their resources.
+void CloudClientDm::updateConnectivityStatistics()
+{
+    int64_t collectionPeriod;
+    uint32_t numPackets;
+    uint32_t numBytes;
+
+    if (_connStatsTxData != NULL) {
+        // Stop collecting if the collection period has expired
+        if (_connStatsRunning && (_connStatsCollectionPeriod != NULL)) {
+            collectionPeriod = _connStatsCollectionPeriod->get_value_int();
+            if ((collectionPeriod > 0) && (_connStatsTimer.read() >= collectionPeriod)) {
+                stopConnectivityStatistics();
+            }
+        }
+
+        numPackets = _connStats[CONN_STATS_TX_PACKETS] + _connStats[CONN_STATS_RX_PACKETS];
+        numBytes = _connStats[CONN_STATS_TX_BYTES] + _connStats[CONN_STATS_RX_BYTES];
+        _connStatsTxData->set_value((int64_t) (_connStats[CONN_STATS_TX_BYTES] / 1024));
+        _connStatsRxData->set_value((int64_t) (_connStats[CONN_STATS_RX_BYTES] / 1024));
+        _connStatsMaxMessageSize->set_value((int64_t) _connStats[CONN_STATS_MAX_PACKET_SIZE]);
+        _connStatsAverageMessageSize->set_value((int64_t) (numPackets > 0 ? numBytes / numPackets : 0));
+    }
+}
+
+// Get the heap currently in use.
+int CloudClientDm::getHeapInUse()
+{
+    int bytes = -1;
+
+#ifdef MBED_HEAP_STATS_ENABLED
+    mbed_stats_heap_t heapStats;
+
+    mbed_stats_heap_get(&heapStats);
+    bytes = heapStats.current_size;
+#endif
+
+    return bytes;
+}
+
+// Mark the start of a tagged code path.
+void CloudClientDm::heapTagBegin(HeapMark *mark)
+{
+#if CLOUD_CLIENT_DM_HEAP_TAGS && defined(MBED_HEAP_STATS_ENABLED)
+    mbed_stats_heap_t heapStats;
+
+    mbed_stats_heap_get(&heapStats);
+    mark->bytes = heapStats.current_size;
+    mark->blocks = heapStats.alloc_cnt;
+    mark->attributedBytes = _heapTagAttributedBytes;
+    mark->attributedBlocks = _heapTagAttributedBlocks;
+#else
+    (void) mark;
+#endif
+}
+
+// Mark the end of a tagged code path.
+void CloudClientDm::heapTagEnd(HeapTag tag, const HeapMark *mark)
+{
+#if CLOUD_CLIENT_DM_HEAP_TAGS && defined(MBED_HEAP_STATS_ENABLED)
+    mbed_stats_heap_t heapStats;
+    HeapTagStats *heapTag = &(_heapTag[tag]);
+    int bytes;
+    int blocks;
+
+    mbed_stats_heap_get(&heapStats);
+    // Whatever nested code paths have claimed is theirs
+    bytes = (int) heapStats.current_size - mark->bytes -
+            (_heapTagAttributedBytes - mark->attributedBytes);
+    blocks = (int) heapStats.alloc_cnt - mark->blocks -
+             (_heapTagAttributedBlocks - mark->attributedBlocks);
+    _heapTagAttributedBytes += bytes;
+    _heapTagAttributedBlocks += blocks;
+
+    heapTag->currentBytes += bytes;
+    heapTag->numBlocks += blocks;
+    heapTag->numCalls++;
+    if (heapTag->currentBytes > heapTag->peakBytes) {
+        heapTag->peakBytes = heapTag->currentBytes;
+    }
+#else
+    (void) tag;
+    (void) mark;
+#endif
+}
+
+// Get the error string for an Mbed Client error code.
+const char *CloudClientDm::getMbedClientErrorString(MbedCloudClient::Error errorCode)
+{
+    const char *errorString = NULL;
+
+    switch (errorCode) {
+        case MbedCloudClient::ConnectErrorNone:
+            errorString = "MbedCloudClient::ConnectErrorNone";
+            break;
+        case MbedCloudClient::ConnectAlreadyExists:
+            errorString = "MbedCloudClient::ConnectAlreadyExists";
+            break;
+        case MbedCloudClient::ConnectBootstrapFailed:
+            errorString = "MbedCloudClient::ConnectBootstrapFailed";
+            break;
+        case MbedCloudClient::ConnectInvalidParameters:
+            errorString = "MbedCloudClient::ConnectInvalidParameters";
+            break;
+        case MbedCloudClient::ConnectNotRegistered:
+            errorString = "MbedCloudClient::ConnectNotRegistered";
+            break;
+        case MbedCloudClient::ConnectTimeout:
+            errorString = "MbedCloudClient::ConnectTimeout";
+            break;
+        case MbedCloudClient::ConnectNetworkError:
+            errorString = "MbedCloudClient::ConnectNetworkError";
+            break;
+        case MbedCloudClient::ConnectResponseParseFailed:
+            errorString = "MbedCloudClient::ConnectResponseParseFailed";
+            break;
+        case MbedCloudClient::ConnectUnknownError:
+            errorString = "MbedCloudClient::ConnectUnknownError";
+            break;
+        case MbedCloudClient::ConnectMemoryConnectFail:
+            errorString = "MbedCloudClient::ConnectMemoryConnectFail";
+            break;
+        case MbedCloudClient::ConnectNotAllowed:
+            errorString = "MbedCloudClient::ConnectNotAllowed";
+            break;
+        case MbedCloudClient::ConnectSecureConnectionFailed:
+            errorString = "MbedCloudClient::ConnectSecureConnectionFailed";
+            break;
+        case MbedCloudClient::ConnectDnsResolvingFailed:
+            errorString = "MbedCloudClient::ConnectDnsResolvingFailed";
+            break;
+#ifdef MBED_CLOUD_CLIENT_SUPPORT_UPDATE
+        case MbedCloudClient::UpdateWarningCertificateNotFound:
+            errorString = "MbedCloudClient::UpdateWarningCertificateNotFound";
+            break;
+        case MbedCloudClient::UpdateWarningIdentityNotFound:
+            errorString = "MbedCloudClient::UpdateWarningIdentityNotFound";
+            break;
+        case MbedCloudClient::UpdateWarningCertificateInvalid:
+            errorString = "MbedCloudClient::UpdateWarningCertificateInvalid";
+            break;
+        case MbedCloudClient::UpdateWarningSignatureInvalid:
+            errorString = "MbedCloudClient::UpdateWarningSignatureInvalid";
+            break;
+        case MbedCloudClient::UpdateWarningVendorMismatch:
+            errorString = "MbedCloudClient::UpdateWarningVendorMismatch";
+            break;
+        case MbedCloudClient::UpdateWarningClassMismatch:
+            errorString = "MbedCloudClient::UpdateWarningClassMismatch";
+            break;
+        case MbedCloudClient::UpdateWarningDeviceMismatch:
+            errorString = "MbedCloudClient::UpdateWarningDeviceMismatch";
+            break;
+        case MbedCloudClient::UpdateWarningURINotFound:
+            errorString = "MbedCloudClient::UpdateWarningURINotFound";
+            break;
+        case MbedCloudClient::UpdateWarningRollbackProtection:
+            errorString = "MbedCloudClient::UpdateWarningRollbackProtection";
+            break;
+        case MbedCloudClient::UpdateWarningUnknown:
+            errorString = "MbedCloudClient::UpdateWarningUnknown";
+            break;
+        case MbedCloudClient::UpdateErrorWriteToStorage:
+            errorString = "MbedCloudClient::UpdateErrorWriteToStorage";
+            break;
+#endif
+        default:
+            errorString = "UNKNOWN";
+            break;
+    }
+
+    return errorString;
+}
+
+// Get the error string for a Cloud Client Storage error code.
+const char *CloudClientDm::getCCSErrorString(ccs_status_e errorCode)
+{
+    const char *errorString = NULL;
+
+    switch (errorCode) {
+        case CCS_STATUS_SUCCESS:
+            errorString = "CloudClientStorage::Success";
+            break;
+        case CCS_STATUS_ERROR:
+            errorString = "CloudClientStorage::Error";
+            break;
+        case CCS_STATUS_KEY_DOESNT_EXIST:
+            errorString = "CloudClientStorage::KeyDoesntExist";
+            break;
+        case CCS_STATUS_VALIDATION_FAIL:
+            errorString = "CloudClientStorage::ValidationFail";
+            break;
+        case CCS_STATUS_MEMORY_ERROR:
+            errorString = "CloudClientStorage::MemoryError";
+            break;
+        default:
+            errorString = "UNKNOWN";
+            break;
+    }
+
+    return errorString;
+}
+
+/**********************************************************************
+ * PUBLIC METHODS: GENERAL
+ **********************************************************************/
+
+// Constructor.
+CloudClientDm::CloudClientDm(bool debugOn,
+                             Callback<void()> registeredUserCallback,
+                             Callback<void()> deregisteredUserCallback,
+                             Callback<void(int)> errorUserCallback)
+{
+    _debugOn = debugOn;
+    _started = false;
+    _registered = false;
+    _awaitingRegistration = false;
+    _deviceObject = M2MInterfaceFactory::create_device();
+    _connMonNetworkBearer = NULL;
+    _connMonAvailableBearer = NULL;
+    _connMonSignalStrength = NULL;
+    _connMonLinkQuality = NULL;
+    _connMonIpAddress = NULL;
+    _connMonApn = NULL;
+    _connMonCellId = NULL;
+    _connMonMnc = NULL;
+    _connMonMcc = NULL;
+    _connStatsTxData = NULL;
+    _connStatsRxData = NULL;
+    _connStatsMaxMessageSize = NULL;
+    _connStatsAverageMessageSize = NULL;
+    _connStatsCollectionPeriod = NULL;
+    _connStatsRunning = false;
+    memset((void *) _connStats, 0, sizeof(_connStats));
+    _updateMinBatteryLevelPercent = -1;
+    _updateRequireIdle = false;
+    _updateIdle = false;
+    _updatePending = false;
+    _updateRequest = 0;
+    _updateProgressPercent = -1;
+    _updateMinHeapFreeBytes = -1;
+    _queueMode = false;
+    _queueSleeping = false;
+    _queuedResources = 0;
+    _unackedResources = 0;
+    _queuedSinceMs = 0;
+    memset(_updatePriority, UPDATE_PRIORITY_NORMAL, sizeof(_updatePriority));
+    for (unsigned int x = 0; x < sizeof(defaultCriticalResources) / sizeof(defaultCriticalResources[0]); x++) {
+        _updatePriority[defaultCriticalResources[x]] = UPDATE_PRIORITY_CRITICAL;
+    }
+    memset(_pendingUpdate, 0, sizeof(_pendingUpdate));
+    _memoryLowFreeBytes = -1;
+    _memoryCriticalFreeBytes = -1;
+    _memoryShedLevel = MEMORY_SHED_NONE;
+    _historyEnabled = false;
+    _historySpill = false;
+    _historyChanged = false;
+    _historyResource = NULL;
+    _resourceHandleList = NULL;
+    _writeBindingList = NULL;
+    _globalUpdateCallback = NULL;
+    memset(_heapTag, 0, sizeof(_heapTag));
+    _heapTagAttributedBytes = 0;
+    _heapTagAttributedBlocks = 0;
+    _connectedInterface = NULL;
+    _registrationFailed = false;
+    _closed = true;
+    memset(_interfaceLatency, 0, sizeof(_interfaceLatency));
+    // Until we know better, assume a middling link
+    _linkQuality.qualityPercent = 50;
+    _linkQuality.blockSize = 256;
+    _linkQuality.ackTimeoutSeconds = 4;
+    _linkQuality.maxRetransmissions = 5;
+    _linkQuality.throughputBytesPerSecond = -1;
+    _linkQualityStartBytes = 0;
+    _linkQualityTimer.start();
+    _radioAccounting = false;
+    _radioCosts = defaultRadioCosts;
+    memset(_radioStats, 0, sizeof(_radioStats));
+    _radioOperation = RADIO_OP_OTHER;
+    _radioOperationMs = 0;
+    _radioLastPacketMs = -1;
+#if CLOUD_CLIENT_DM_READ_CALLBACKS
+    memset(_constString, 0, sizeof(_constString));
+#endif
+    _batchResource = NULL;
+    _attachThread = NULL;
+    _attachInterface = NULL;
+    _attached = false;
+    _attachConnected = false;
+    _bootToRegisteredMs = -1;
+    _bootTimer.start();
+    _powerPolicyTable = NULL;
+    _powerPolicyNumEntries = 0;
+    _powerPolicy = NULL;
+    _pendingPowerSourceResources = 0;
+    _keepAliveTimer.start();
+    memset(_powerReportMs, 0, sizeof(_powerReportMs));
+    _registeredUserCallback = registeredUserCallback;
+    _deregisteredUserCallback = deregisteredUserCallback;
+    _errorUserCallback = errorUserCallback;
+
+#if CLOUD_CLIENT_DM_LOG_DEFERRED
+    // Debug prints go to a ring buffer; start the
+    // low-priority thread that prints them out
+    if (_debugOn) {
+        cloudClientDmLogStart();
+    }
+#endif
+
+    for (unsigned int x = 0; x < sizeof(_powerSourceInstance) / sizeof (_powerSourceInstance[0]); x++) {
+        _powerSourceInstance[x] = POWER_SOURCE_UNUSED;
+        _history[x] = NULL;
+    }
+
+    for (unsigned int x = 0; x < sizeof(_subscriber) / sizeof(_subscriber[0]); x++) {
+        _subscriber[x].eventMask = 0;
+        _subscriber[x].queue = NULL;
+    }
+
+    for (unsigned int x = 0; x < sizeof(_writeHandler) / sizeof(_writeHandler[0]); x++) {
+        _writeHandler[x].used = false;
+    }
+
+    resetStats();
+}
+
+// Destructor.
+CloudClientDm::~CloudClientDm()
+{
+    if (_updateInstance == this) {
+        _updateInstance = NULL;
+    }
+
+    for (uint16_t x = 0; x < sizeof(_history) / sizeof(_history[0]); x++) {
+        deleteHistory(x);
+    }
+
+    if (_attachThread != NULL) {
+        _attachThread->join();
+        delete _attachThread;
+    }
+
+    while (_resourceHandleList != NULL) {
+        ResourceHandleBase *next = _resourceHandleList->_next;
+        delete _resourceHandleList;
+        _resourceHandleList = next;
+    }
+
+    while (_writeBindingList != NULL) {
+        WriteBinding *next = _writeBindingList->_next;
+        delete _writeBindingList;
+        _writeBindingList = next;
+    }
+
+    // Delete the objects that we created ourselves
+    for (int x = 0; x < _ownObjectList.size(); x++) {
+        delete _ownObjectList[x];
+    }
+}
+
+// Add an M2M object that you have created to the client.
+void CloudClientDm::addObject(M2MObject *object)
+{
+    HeapMark heapMark;
+
+    printfLog("Adding object: \"%s\" to Mbed Cloud Client's list...\n", object->name());
+    heapTagBegin(&heapMark);
+    _objectList.push_back(object);
+    heapTagEnd(HEAP_TAG_OBJECTS, &heapMark);
+}
+
+// Initialise LWM2M and its objects.
+bool CloudClientDm::start(MbedCloudClientCallback *globalUpdateCallback)
+{
+    HeapMark heapMark;
+
+    heapTagBegin(&heapMark);
+    _cloudClient.add_objects(_objectList);
+    heapTagEnd(HEAP_TAG_CLOUD_CLIENT, &heapMark);
+    _cloudClient.on_registered(this, &CloudClientDm::clientRegisteredCallback);
+    _cloudClient.on_unregistered(this, &CloudClientDm::clientDeregisteredCallback);
+    _cloudClient.on_error(this, &CloudClientDm::errorCallback);
+    _cloudClient.on_registration_updated(this, &CloudClientDm::clientRegistrationUpdatedCallback);
+#ifdef MBED_CLOUD_CLIENT_TRANSPORT_MODE_UDP_QUEUE
+    _cloudClient.set_queue_sleep_handler(callback_handler(this, &CloudClientDm::queueSleepCallback));
+#endif
+    // Writes covered by a write handler go straight to it,
+    // the rest to the global callback
+    _globalUpdateCallback = globalUpdateCallback;
+    bindWriteHandlers();
+    if (globalUpdateCallback != NULL) {
+        _cloudClient.set_update_callback(globalUpdateCallback);
+    }
+
+    // Only now are we started, as far as the network attach
+    // thread is concerned; if the network came up while we were
+    // being configured, register straight away
+    _started = true;
+    connectAfterAttach();
+
+    return true;
+}
+
+// Close the cloud client and release its objects,
+// deregistering from the server.
+void CloudClientDm::stop(int drainTimeoutMs)
+{
+    Timer timer;
+    HeapMark heapMark;
+
+    if ((drainTimeoutMs > 0) && _registered && (_deviceObject != NULL)) {
+        drain(drainTimeoutMs);
+    }
+
+    // This is an asynchronous operation,
+    // the connection is not closed until
+    // clientDeregisteredCallback() is called
+    timer.start();
+    heapTagBegin(&heapMark);
+    _cloudClient.close();
+    while (_registered && (timer.read_ms() < CLOUD_CLIENT_STOP_TIMEOUT_SECONDS * 1000))  {
+        wait_ms(100);
+    }
+    heapTagEnd(HEAP_TAG_CLOUD_CLIENT, &heapMark);
+
+    // Delete the available power source and associated Device object
+    // resources that have been created
+    for (uint16_t x = 0; (x < sizeof(_powerSourceInstance) / sizeof (_powerSourceInstance[0])); x++) {
+        if (_powerSourceInstance[x] != POWER_SOURCE_UNUSED) {
+            deleteDeviceObjectResource(M2MDevice::AvailablePowerSources, x);
+            deleteDeviceObjectResource(M2MDevice::PowerSourceVoltage, x);
+            deleteDeviceObjectResource(M2MDevice::PowerSourceCurrent, x);
+            // Don't leak the resources that come with an internal battery
+            if (_powerSourceInstance[x] == POWER_SOURCE_INTERNAL_BATTERY) {
+                deleteDeviceObjectResource(M2MDevice::BatteryLevel);
+                deleteDeviceObjectResource(M2MDevice::BatteryStatus);
+            }
+            _powerSourceInstance[x] = POWER_SOURCE_UNUSED;
+            deleteHistory(x);
+        }
+    }
+    // Everything else will be freed when we are deleted
+}
+
+// Connect the Mbed Cloud Client with the server.
+bool CloudClientDm::connect(void *interface)
+{
+    bool success = false;
+    HeapMark heapMark;
+
+    if (_started) {
+        _stats.numConnects++;
+        _awaitingRegistration = true;
+        _registrationTimer.reset();
+        _registrationTimer.start();
+        _registrationFailed = false;
+        setRadioOperation(RADIO_OP_REGISTRATION);
+        heapTagBegin(&heapMark);
+        success = _cloudClient.setup(interface);
+        heapTagEnd(HEAP_TAG_CLOUD_CLIENT, &heapMark);
+
+#ifdef MBED_CLOUD_CLIENT_SUPPORT_UPDATE
+        /* Set callback functions for authorizing updates and monitoring progress.
+           Each step of an update is authorized only when the update policy
+           (see setUpdatePolicy()) allows it and progress is passed on to the
+           application in whole-percent steps.
+        */
+        update_ui_set_cloud_client(&_cloudClient);
+        _updateInstance = this;
+        _cloudClient.set_update_authorize_handler(updateAuthorizeHandler);
+        _cloudClient.set_update_progress_handler(updateProgressHandler);
+#endif
+    }
+
+    return success;
+}
+
+// Connect over the first of a list of network interfaces that works.
+bool CloudClientDm::connect(NetworkInterface * const *interfaces, int numInterfaces,
+                            int timeoutSeconds)
+{
+    // Ranks for interfaces with no latency to go on
+    const int rankUntried = 0x7FFFFFFE;
+    const int rankFailed = 0x7FFFFFFF;
+    NetworkInterface *ranked[CLOUD_CLIENT_MAX_NUM_INTERFACES];
+    NetworkInterface *interface;
+    int rank[CLOUD_CLIENT_MAX_NUM_INTERFACES];
+    int thisRank;
+    int latencyMs;
+    int x;
+    int y;
+    nsapi_error_t nsapiError;
+    bool setUp;
+    Timer timer;
+
+    _connectedInterface = NULL;
+    if (numInterfaces > CLOUD_CLIENT_MAX_NUM_INTERFACES) {
+        printfLogWarn("Only the first %d of %d interfaces will be tried.\n",
+                      CLOUD_CLIENT_MAX_NUM_INTERFACES, numInterfaces);
+        numInterfaces = CLOUD_CLIENT_MAX_NUM_INTERFACES;
+    }
+    if (_started && (interfaces != NULL)) {
+        // Rank the interfaces: registered, fastest first, then
+        // untried, in the order given, then failed; an insertion
+        // sort is plenty for a handful
+        for (x = 0; x < numInterfaces; x++) {
+            y = findInterfaceLatency(interfaces[x], false);
+            if (y < 0) {
+                thisRank = rankUntried;
+            } else if (_interfaceLatency[y].latencyMs < 0) {
+                thisRank = rankFailed;
+            } else {
+                thisRank = _interfaceLatency[y].latencyMs;
+            }
+            for (y = x; (y > 0) && (thisRank < rank[y - 1]); y--) {
+                ranked[y] = ranked[y - 1];
+                rank[y] = rank[y - 1];
+            }
+            ranked[y] = interfaces[x];
+            rank[y] = thisRank;
+        }
+
+        for (x = 0; (x < numInterfaces) && (_connectedInterface == NULL); x++) {
+            interface = ranked[x];
+            timer.reset();
+            timer.start();
+            setUp = false;
+            // An interface that is already up is fine, but
+            // is left up if registration over it fails
+            nsapiError = interface->connect();
+            if ((nsapiError == NSAPI_ERROR_OK) || (nsapiError == NSAPI_ERROR_IS_CONNECTED)) {
+                _closed = false;
+                setUp = connect(interface);
+                while (setUp && !_registered && !_registrationFailed &&
+                       (timer.read_ms() < timeoutSeconds * 1000)) {
+                    wait_ms(100);
+                }
+            }
+            latencyMs = timer.read_ms();
+            y = findInterfaceLatency(interface, true);
+            if (_registered) {
+                _connectedInterface = interface;
+                printfLog("Registered over interface %d of %d in %d ms.\n",
+                          x + 1, numInterfaces, latencyMs);
+            } else {
+                latencyMs = -1;
+                printfLogError("Error registering over interface %d of %d.\n",
+                               x + 1, numInterfaces);
+                if (setUp) {
+                    // This is an asynchronous operation, as in stop(),
+                    // so wait for it before setting up again or taking
+                    // the link away from under the Mbed Cloud Client
+                    timer.reset();
+                    _cloudClient.close();
+                    while (!_closed && (timer.read_ms() < CLOUD_CLIENT_STOP_TIMEOUT_SECONDS * 1000)) {
+                        wait_ms(100);
+                    }
+                    if (!_closed) {
+                        printfLogWarn("Mbed Cloud Client did not confirm close.\n");
+                    }
+                }
+                if (nsapiError == NSAPI_ERROR_OK) {
+                    interface->disconnect();
+                }
+            }
+            if (y >= 0) {
+                _interfaceLatency[y].latencyMs = latencyMs;
+            }
+        }
+    }
+
+    return (_connectedInterface != NULL);
+}
+
+// Get the estimated quality of the link to the server.
+void CloudClientDm::getLinkQuality(LinkQuality *linkQuality)
+{
+    if (linkQuality != NULL) {
+        *linkQuality = _linkQuality;
+    }
+}
+
+// Set a callback for changes in the recommended CoAP parameters.
+void CloudClientDm::setLinkQualityCallback(Callback<void(const LinkQuality *)> linkQualityCallback)
+{
+    _linkQualityUserCallback = linkQualityCallback;
+}
+
+// Get the interface that connect() with a list of interfaces registered over.
+NetworkInterface *CloudClientDm::getConnectedInterface()
+{
+    return _connectedInterface;
+}
+
+// Return true if the cloud client is connected to the server.
+bool CloudClientDm::isConnected()
+{
+    return _registered;
+}
+
+// Keep a UDP link up
+void CloudClientDm::keepAlive()
+{
+    HeapMark heapMark;
+
+    // The power policy may stretch the keep-alive interval
+    if ((_powerPolicy == NULL) ||
+        (_keepAliveTimer.read_ms() >= _powerPolicy->keepAliveIntervalSeconds * 1000)) {
+        setRadioOperation(RADIO_OP_KEEP_ALIVE);
+        heapTagBegin(&heapMark);
+        _cloudClient.keep_alive();
+        heapTagEnd(HEAP_TAG_CLOUD_CLIENT, &heapMark);
+        _keepAliveTimer.reset();
+    }
+    updateMemoryPressure();
+    flushPowerSourceResources(false);
+    flushUpdates(CLOUD_CLIENT_MAX_UPDATES_PER_FLUSH);
+    updateConnectivityStatistics();
+    updateLinkThroughput();
+    updateDeviceObjectHistory();
+    flushResources();
+    checkUpdatePending();
+}
+
+// Get the statistics.
+void CloudClientDm::getStats(Stats *stats)
+{
+    if (stats != NULL) {
+        *stats = _stats;
+        stats->periodMs = _statsTimer.read_ms();
+        stats->bootToRegisteredMs = _bootToRegisteredMs;
+        memcpy(stats->heapTag, _heapTag, sizeof(stats->heapTag));
+#ifdef MBED_HEAP_STATS_ENABLED
+        mbed_stats_heap_t heapStats;
+
+        mbed_stats_heap_get(&heapStats);
+        stats->heapCurrentBytes = heapStats.current_size;
+        stats->heapMaxBytes = heapStats.max_size;
+        stats->heapAllocFailures = heapStats.alloc_fail_cnt;
+#endif
+    }
+}
+
+// Reset the statistics.
+void CloudClientDm::resetStats()
+{
+    memset(&_stats, 0, sizeof(_stats));
+    _stats.lastRegistrationLatencyMs = -1;
+    _stats.maxRegistrationLatencyMs = -1;
+    _stats.heapStartBytes = getHeapInUse();
+    _stats.heapCurrentBytes = -1;
+    _stats.heapMaxBytes = -1;
+    _stats.heapAllocFailures = -1;
+    _stats.lastBatchBytes = -1;
+    _stats.lastBatchResourceBytes = -1;
+    _stats.lastBatchEncodeUs = -1;
+    _stats.attachMs = -1;
+    _stats.lastDrainMs = -1;
+    _stats.lastDrainFlushed = -1;
+    _stats.lastDrainDropped = -1;
+    _stats.lastPlugUs = -1;
+    _stats.maxPlugUs = -1;
+    memset(_radioStats, 0, sizeof(_radioStats));
+    for (unsigned int x = 0; x < sizeof(_stats.updateClass) / sizeof(_stats.updateClass[0]); x++) {
+        _stats.updateClass[x].lastDelayMs = -1;
+        _stats.updateClass[x].maxDelayMs = -1;
+    }
+    _statsTimer.reset();
+    _statsTimer.start();
+}
+
+// Get the heap attributed to a part of CloudClientDm.
+bool CloudClientDm::getHeapTagStats(HeapTag tag, HeapTagStats *stats)
+{
+    bool success = false;
+
+#if CLOUD_CLIENT_DM_HEAP_TAGS && defined(MBED_HEAP_STATS_ENABLED)
+    if ((tag < MAX_NUM_HEAP_TAGS) && (stats != NULL)) {
+        *stats = _heapTag[tag];
+        success = true;
+    }
+#else
+    (void) tag;
+    (void) stats;
+#endif
+
+    return success;
+}
+
+/**********************************************************************
+ * PUBLIC METHODS: DEVICE OBJECT
+ **********************************************************************/
+
+// Set the Device object Device Type resource.
+bool CloudClientDm::setDeviceObjectStaticDeviceType(const char *deviceType)
+{
+    return setDeviceObjectConfigResource(M2MDevice::DeviceType, deviceType);
+}
+
+// Set the Device object Serial Number resource.
+bool CloudClientDm::setDeviceObjectStaticSerialNumber(const char *serialNumber)
+{
+    return setDeviceObjectConfigResource(M2MDevice::SerialNumber, serialNumber);
+}
+
+// Set the Device object Hardware Version resource.
+bool CloudClientDm::setDeviceObjectStaticHardwareVersion(const char *hardwareVersion)
+{
+    return setDeviceObjectConfigResource(M2MDevice::HardwareVersion, hardwareVersion);
+}
+
+// Set the Device object Software Version resource.
+bool CloudClientDm::setDeviceObjectSoftwareVersion(const char *softwareVersion)
+{
+    return setDeviceObjectResource(M2MDevice::SoftwareVersion, softwareVersion);
+}
+
+// Set the Device object Firmware Version resource.
+bool CloudClientDm::setDeviceObjectFirmwareVersion(const char *firmwareVersion)
+{
+    return setDeviceObjectResource(M2MDevice::FirmwareVersion, firmwareVersion);
+}
+
+// Add a Device object Available Power Source resource.
+bool CloudClientDm::addDeviceObjectPowerSource(PowerSource powerSource)
+{
+    bool success = false;
+    int instance = -1;
+    Timer timer;
+
+    timer.start();
+
+    // Find a spare instance ID
+    for (unsigned int x = 0; (x < sizeof(_powerSourceInstance) / sizeof (_powerSourceInstance[0])) && (instance < 0); x++) {
+        if (_powerSourceInstance[x] == POWER_SOURCE_UNUSED) {
+            instance = x;
+        }
+    }
+
+    if (instance >= 0) {
+        success = createPowerSourceInstance(powerSource, instance);
+    }
+    recordPlugEvent(timer.read_us());
+
+    return success;
+}
+
+// Check if a Device object Available Power Source resource of a given type
+// already exists
+bool CloudClientDm::existsDeviceObjectPowerSource(PowerSource powerSource)
+{
+    bool foundIt = false;
+
+    // Find the instance ID
+    for (unsigned int x = 0; (x < sizeof(_powerSourceInstance) / sizeof (_powerSourceInstance[0])) && !foundIt; x++) {
+        if (_powerSourceInstance[x] == powerSource) {
+            foundIt = true;
+        }
+    }
+
+    return foundIt;
+}
+
+// Delete a Device object Available Power Source resource.
+bool CloudClientDm::deleteDeviceObjectPowerSource(PowerSource powerSource)
+{
+    bool success = false;
+    bool foundIt = false;
+    uint16_t x;
+    Timer timer;
+
+    timer.start();
+
+    // Find the instance ID
+    for (x = 0; (x < sizeof(_powerSourceInstance) / sizeof (_powerSourceInstance[0])) && !foundIt; x++) {
+        if (_powerSourceInstance[x] == powerSource) {
+            foundIt = true;
+        }
+    }
+
+    // Delete those Available Power Source, Voltage and Current instances
+    if (foundIt) {
+        x--;
+        success = deleteDeviceObjectResource(M2MDevice::AvailablePowerSources, x) &&
+                  deleteDeviceObjectResource(M2MDevice::PowerSourceVoltage, x) &&
+                  deleteDeviceObjectResource(M2MDevice::PowerSourceCurrent, x);
+        if (success) {
+            deleteHistory(x);
+        }
+        if (success) {
+            _powerSourceInstance[x] = POWER_SOURCE_UNUSED;
+            _pendingPowerSourceResources &= ~(3UL << (x * 2));
+            // Anything held back for it is moot now
+            for (unsigned int y = 0; y < sizeof(_pendingUpdate) / sizeof(_pendingUpdate[0]); y++) {
+                if (_pendingUpdate[y].used && (_pendingUpdate[y].instance == x) &&
+                    ((_pendingUpdate[y].resource == M2MDevice::PowerSourceVoltage) ||
+                     (_pendingUpdate[y].resource == M2MDevice::PowerSourceCurrent))) {
+                    _pendingUpdate[y].used = false;
+                }
+            }
+        }
+        // For internal battery, also delete the status and percentage remaining resources
+        if (success && (powerSource == POWER_SOURCE_INTERNAL_BATTERY)) {
+            success = deleteDeviceObjectResource(M2MDevice::BatteryLevel) &&
+                      deleteDeviceObjectResource(M2MDevice::BatteryStatus);
+            for (unsigned int y = 0; y < sizeof(_pendingUpdate) / sizeof(_pendingUpdate[0]); y++) {
+                if (_pendingUpdate[y].used &&
+                    ((_pendingUpdate[y].resource == M2MDevice::BatteryLevel) ||
+                     (_pendingUpdate[y].resource == M2MDevice::BatteryStatus))) {
+                    _pendingUpdate[y].used = false;
+                }
+            }
+        }
+        queueDeviceObjectResource(M2MDevice::AvailablePowerSources);
+        updatePowerPolicy();
+    }
+    recordPlugEvent(timer.read_us());
+
+    return success;
 }
 
-// Get the error string for a Cloud Client Storage error code.
-const char *CloudClientDm::getCCSErrorString(ccs_status_e errorCode)
+// Set the Device object Power Source Voltage resource.
+bool CloudClientDm::setDeviceObjectVoltage(PowerSource powerSource, int voltageMV)
 {
-    const char *errorString = NULL;
+    bool success = false;
+    bool foundIt = false;
+    uint16_t x;
 
-    switch (errorCode) {
-        case CCS_STATUS_SUCCESS:
-            errorString = "CloudClientStorage::Success";
-            break;
-        case CCS_STATUS_ERROR:
-            errorString = "CloudClientStorage::Error";
-            break;
-        case CCS_STATUS_KEY_DOESNT_EXIST:
-            errorString = "CloudClientStorage::KeyDoesntExist";
-            break;
-        case CCS_STATUS_VALIDATION_FAIL:
-            errorString = "CloudClientStorage::ValidationFail";
-            break;
-        case CCS_STATUS_MEMORY_ERROR:
-            errorString = "CloudClientStorage::MemoryError";
+     // Find the instance ID
+     for (x = 0; (x < sizeof(_powerSourceInstance) / sizeof (_powerSourceInstance[0])) && !foundIt; x++) {
+         if (_powerSourceInstance[x] == powerSource) {
+             foundIt = true;
+         }
+     }
+
+     if (foundIt) {
+         x--;
+         success = setPowerSourceResource(M2MDevice::PowerSourceVoltage, voltageMV, x);
+         addHistorySample(x, 0, voltageMV);
+     }
+
+    return success;
+}
+
+// Set the Device object Power Source Current resource.
+bool CloudClientDm::setDeviceObjectCurrent(PowerSource powerSource, int currentMA)
+{
+    bool success = false;
+    bool foundIt = false;
+    uint16_t x;
+
+     // Find the instance ID
+     for (x = 0; (x < sizeof(_powerSourceInstance) / sizeof (_powerSourceInstance[0])) && !foundIt; x++) {
+         if (_powerSourceInstance[x] == powerSource) {
+             foundIt = true;
+         }
+     }
+
+     if (foundIt) {
+         x--;
+         success = setPowerSourceResource(M2MDevice::PowerSourceCurrent, currentMA, x);
+         addHistorySample(x, 1, currentMA);
+     }
+
+    return success;
+}
+
+// Set the Device object Battery Level resource.
+bool CloudClientDm::setDeviceObjectBatteryLevel(int batteryLevelPercent)
+{
+    bool success = setDeviceObjectResource(M2MDevice::BatteryLevel, (int64_t) batteryLevelPercent);
+    int instance = getPowerSourceInstance(POWER_SOURCE_INTERNAL_BATTERY);
+
+    if (instance >= 0) {
+        addHistorySample(instance, 2, batteryLevelPercent);
+    }
+
+    updatePowerPolicy();
+
+    // A deferred firmware update may now be allowed
+    checkUpdatePending();
+
+    return success;
+}
+
+// Set the Device object Battery Status resource.
+bool CloudClientDm::setDeviceObjectBatteryStatus(CloudClientDm::BatteryStatus batteryStatus)
+{
+    bool success = setDeviceObjectResource(M2MDevice::BatteryStatus, (int64_t) batteryStatus);
+
+    updatePowerPolicy();
+
+    return success;
+}
+
+// Set the Device object Memory Total resource.
+bool CloudClientDm::setDeviceObjectMemoryTotal(int64_t memoryTotalKBytes)
+{
+    return setDeviceObjectResource(M2MDevice::MemoryTotal, memoryTotalKBytes);
+}
+
+// Set the Device object Memory Free resource.
+bool CloudClientDm::setDeviceObjectMemoryFree(int64_t memoryFreeKBytes)
+{
+    return setDeviceObjectResource(M2MDevice::MemoryFree, memoryFreeKBytes);
+}
+
+// Set the Device object Error Code resource.
+bool CloudClientDm::setDeviceObjectErrorCode(CloudClientDm::Error errorCode)
+{
+    return setDeviceObjectResource(M2MDevice::ErrorCode, (int64_t) errorCode, 0);
+}
+
+// Set the Device object UTC Offset resource.
+bool CloudClientDm::setDeviceObjectUtcOffset(const char *utcOffsetISO8601)
+{
+    return setDeviceObjectResource(M2MDevice::UTCOffset, utcOffsetISO8601);
+}
+
+// Set the Device object Timezone resource.
+bool CloudClientDm::setDeviceObjectTimezone(const char *timezoneIANA)
+{
+    return setDeviceObjectResource(M2MDevice::Timezone, timezoneIANA);
+}
+
+#if CLOUD_CLIENT_DM_READ_CALLBACKS
+// Set a Device object string resource by reference.
+bool CloudClientDm::setDeviceObjectConstString(M2MDevice::DeviceResource resource,
+                                               const char *value)
+{
+    M2MResource *m2mResource = NULL;
+    bool success = false;
+
+    switch (resource) {
+        case M2MDevice::DeviceType:
+        case M2MDevice::SerialNumber:
+        case M2MDevice::HardwareVersion:
+        case M2MDevice::SoftwareVersion:
+            if (!_started && (_deviceObject != NULL) && (value != NULL)) {
+                // The resource is created empty, so that it holds no copy
+                if (!_deviceObject->is_resource_present(resource)) {
+                    createDeviceObjectResource(resource, "");
+                } else {
+                    _deviceObject->set_resource_value(resource, String(""));
+                }
+                m2mResource = _deviceObject->get_resource(resource);
+            }
             break;
         default:
-            errorString = "UNKNOWN";
             break;
     }
 
-    return errorString;
+    if (m2mResource != NULL) {
+        for (unsigned int x = 0; (x < sizeof(_constString) / sizeof(_constString[0])) && !success; x++) {
+            if ((_constString[x].resource == NULL) || (_constString[x].resource == m2mResource)) {
+                _constString[x].resource = m2mResource;
+                _constString[x].value = value;
+                success = m2mResource->set_read_resource_function(readConstStringCallback, this);
+            }
+        }
+    }
+
+    if (!success) {
+        printfLogError("Error setting %s by reference.\n", deviceObjectResourceString[resource]);
+    }
+
+    return success;
 }
+#endif
 
 /**********************************************************************
- * PUBLIC METHODS: GENERAL
+ * PUBLIC METHODS: CONNECTIVITY OBJECTS
  **********************************************************************/
 
-// Constructor.
-CloudClientDm::CloudClientDm(bool debugOn,
-                             Callback<void()> registeredUserCallback,
-                             Callback<void()> deregisteredUserCallback,
-                             Callback<void(int)> errorUserCallback)
+// Add the Connectivity Monitoring object.
+bool CloudClientDm::addConnectivityMonitoringObject()
 {
-    _debugOn = debugOn;
-    _started = false;
-    _registered = false;
-    _registeredUserCallback = registeredUserCallback;
-    _deregisteredUserCallback = deregisteredUserCallback;
-    _errorUserCallback = errorUserCallback;
+    M2MObjectInstance *objectInstance;
+    bool success = false;
 
-    for (unsigned int x = 0; x < sizeof(_powerSourceInstance) / sizeof (_powerSourceInstance[0]); x++) {
-        _powerSourceInstance[x] = POWER_SOURCE_UNUSED;
+    if (!_started && (_connMonNetworkBearer == NULL)) {
+        objectInstance = createObject("4");
+        _connMonNetworkBearer = createResource(objectInstance, "0", M2MResourceInstance::INTEGER,
+                                               M2MBase::GET_ALLOWED);
+        _connMonAvailableBearer = createResourceInstance(objectInstance, "1", M2MResourceInstance::INTEGER);
+        _connMonSignalStrength = createResource(objectInstance, "2", M2MResourceInstance::INTEGER,
+                                                M2MBase::GET_ALLOWED);
+        _connMonLinkQuality = createResource(objectInstance, "3", M2MResourceInstance::INTEGER,
+                                             M2MBase::GET_ALLOWED);
+        _connMonIpAddress = createResourceInstance(objectInstance, "4", M2MResourceInstance::STRING);
+        _connMonApn = createResourceInstance(objectInstance, "7", M2MResourceInstance::STRING);
+        _connMonCellId = createResource(objectInstance, "8", M2MResourceInstance::INTEGER,
+                                        M2MBase::GET_ALLOWED);
+        _connMonMnc = createResource(objectInstance, "9", M2MResourceInstance::INTEGER,
+                                     M2MBase::GET_ALLOWED);
+        _connMonMcc = createResource(objectInstance, "10", M2MResourceInstance::INTEGER,
+                                     M2MBase::GET_ALLOWED);
+        success = (_connMonNetworkBearer != NULL) && (_connMonAvailableBearer != NULL) &&
+                  (_connMonSignalStrength != NULL) && (_connMonLinkQuality != NULL) &&
+                  (_connMonIpAddress != NULL) && (_connMonApn != NULL) &&
+                  (_connMonCellId != NULL) && (_connMonMnc != NULL) && (_connMonMcc != NULL);
     }
+
+    return success;
 }
 
-// Destructor.
-CloudClientDm::~CloudClientDm()
+// Set the Connectivity Monitoring Network Bearer resource.
+bool CloudClientDm::setConnectivityMonitoringBearer(NetworkBearer bearer)
 {
+    bool success = false;
+
+    if ((_connMonNetworkBearer != NULL) && (_connMonAvailableBearer != NULL)) {
+        success = _connMonNetworkBearer->set_value((int64_t) bearer) &&
+                  _connMonAvailableBearer->set_value((int64_t) bearer);
+    }
+
+    return success;
 }
 
-// Add an M2M object that you have created to the client.
-void CloudClientDm::addObject(M2MObject *object)
+// Set the Connectivity Monitoring radio resources.
+bool CloudClientDm::setConnectivityMonitoringRadio(int signalStrengthDbm, int linkQuality)
 {
-    printfLog("Adding object: \"%s\" to Mbed Cloud Client's list...\n", object->name());
-    _objectList.push_back(object);
+    bool success = false;
+
+    if ((_connMonSignalStrength != NULL) && (_connMonLinkQuality != NULL)) {
+        success = _connMonSignalStrength->set_value((int64_t) signalStrengthDbm) &&
+                  _connMonLinkQuality->set_value((int64_t) linkQuality);
+    }
+
+    return success;
 }
 
-// Initialise LWM2M and its objects.
-bool CloudClientDm::start(MbedCloudClientCallback *globalUpdateCallback)
+// Set the Connectivity Monitoring cell resources.
+bool CloudClientDm::setConnectivityMonitoringCell(int cellId, int mnc, int mcc)
 {
-    _started = true;
-    _cloudClient.add_objects(_objectList);
-    _cloudClient.on_registered(this, &CloudClientDm::clientRegisteredCallback);
-    _cloudClient.on_unregistered(this, &CloudClientDm::clientDeregisteredCallback);
-    _cloudClient.on_error(this, &CloudClientDm::errorCallback);
-    if (globalUpdateCallback != NULL) {
-        _cloudClient.set_update_callback(globalUpdateCallback);
+    bool success = false;
+
+    if ((_connMonCellId != NULL) && (_connMonMnc != NULL) && (_connMonMcc != NULL)) {
+        success = _connMonCellId->set_value((int64_t) cellId) &&
+                  _connMonMnc->set_value((int64_t) mnc) &&
+                  _connMonMcc->set_value((int64_t) mcc);
+    }
+
+    return success;
+}
+
+// Set the Connectivity Monitoring IP Addresses resource.
+bool CloudClientDm::setConnectivityMonitoringIpAddress(const char *ipAddress)
+{
+    bool success = false;
+
+    if ((_connMonIpAddress != NULL) && (ipAddress != NULL)) {
+        success = _connMonIpAddress->set_value((const uint8_t *) ipAddress, strlen(ipAddress));
+    }
+
+    return success;
+}
+
+// Set the Connectivity Monitoring APN resource.
+bool CloudClientDm::setConnectivityMonitoringApn(const char *apn)
+{
+    bool success = false;
+
+    if ((_connMonApn != NULL) && (apn != NULL)) {
+        success = _connMonApn->set_value((const uint8_t *) apn, strlen(apn));
+    }
+
+    return success;
+}
+
+// Add the Connectivity Statistics object.
+bool CloudClientDm::addConnectivityStatisticsObject()
+{
+    M2MObjectInstance *objectInstance;
+    M2MResource *startResource;
+    M2MResource *stopResource;
+    bool success = false;
+
+    if (!_started && (_connStatsTxData == NULL)) {
+        objectInstance = createObject("7");
+        _connStatsTxData = createResource(objectInstance, "2", M2MResourceInstance::INTEGER,
+                                          M2MBase::GET_ALLOWED);
+        _connStatsRxData = createResource(objectInstance, "3", M2MResourceInstance::INTEGER,
+                                          M2MBase::GET_ALLOWED);
+        _connStatsMaxMessageSize = createResource(objectInstance, "4", M2MResourceInstance::INTEGER,
+                                                  M2MBase::GET_ALLOWED);
+        _connStatsAverageMessageSize = createResource(objectInstance, "5", M2MResourceInstance::INTEGER,
+                                                      M2MBase::GET_ALLOWED);
+        startResource = createResource(objectInstance, "6", M2MResourceInstance::OPAQUE,
+                                       M2MBase::POST_ALLOWED);
+        stopResource = createResource(objectInstance, "7", M2MResourceInstance::OPAQUE,
+                                      M2MBase::POST_ALLOWED);
+        _connStatsCollectionPeriod = createResource(objectInstance, "8", M2MResourceInstance::INTEGER,
+                                                    M2MBase::GET_PUT_ALLOWED);
+        if (startResource != NULL) {
+            startResource->set_execute_function(execute_callback(this,
+                                                &CloudClientDm::connectivityStatisticsStartCallback));
+        }
+        if (stopResource != NULL) {
+            stopResource->set_execute_function(execute_callback(this,
+                                               &CloudClientDm::connectivityStatisticsStopCallback));
+        }
+        if (_connStatsCollectionPeriod != NULL) {
+            _connStatsCollectionPeriod->set_value((int64_t) 0);
+            _connStatsCollectionPeriod->set_value_updated_function(value_updated_callback(this,
+                                                                   &CloudClientDm::connectivityStatisticsPeriodCallback));
+        }
+        success = (_connStatsTxData != NULL) && (_connStatsRxData != NULL) &&
+                  (_connStatsMaxMessageSize != NULL) && (_connStatsAverageMessageSize != NULL) &&
+                  (startResource != NULL) && (stopResource != NULL) &&
+                  (_connStatsCollectionPeriod != NULL);
+    }
+
+    return success;
+}
+
+// Start collecting connectivity statistics.
+void CloudClientDm::startConnectivityStatistics()
+{
+    _connStatsRunning = false;
+    core_util_critical_section_enter();
+    memset((void *) _connStats, 0, sizeof(_connStats));
+    core_util_critical_section_exit();
+    _connStatsTimer.reset();
+    _connStatsTimer.start();
+    _connStatsRunning = true;
+    updateConnectivityStatistics();
+}
+
+// Stop collecting connectivity statistics.
+void CloudClientDm::stopConnectivityStatistics()
+{
+    _connStatsRunning = false;
+    _connStatsTimer.stop();
+    updateConnectivityStatistics();
+}
+
+// Count an IP packet sent.
+void CloudClientDm::countConnectivityTx(uint32_t bytes)
+{
+    if (_radioAccounting) {
+        countRadio(true, bytes);
+    }
+    if (_connStatsRunning) {
+        core_util_atomic_incr_u32(&_connStats[CONN_STATS_TX_BYTES], bytes);
+        core_util_atomic_incr_u32(&_connStats[CONN_STATS_TX_PACKETS], 1);
+        // A lost update here only costs accuracy
+        if (bytes > _connStats[CONN_STATS_MAX_PACKET_SIZE]) {
+            _connStats[CONN_STATS_MAX_PACKET_SIZE] = bytes;
+        }
+    }
+}
+
+// Count an IP packet received.
+void CloudClientDm::countConnectivityRx(uint32_t bytes)
+{
+    if (_radioAccounting) {
+        countRadio(false, bytes);
+    }
+    if (_connStatsRunning) {
+        core_util_atomic_incr_u32(&_connStats[CONN_STATS_RX_BYTES], bytes);
+        core_util_atomic_incr_u32(&_connStats[CONN_STATS_RX_PACKETS], 1);
+        // A lost update here only costs accuracy
+        if (bytes > _connStats[CONN_STATS_MAX_PACKET_SIZE]) {
+            _connStats[CONN_STATS_MAX_PACKET_SIZE] = bytes;
+        }
+    }
+}
+
+/**********************************************************************
+ * PUBLIC METHODS: FIRMWARE UPDATE
+ **********************************************************************/
+
+// Set the policy for authorizing firmware update steps.
+void CloudClientDm::setUpdatePolicy(int minBatteryLevelPercent, bool requireIdle,
+                                    Callback<bool(int32_t)> policyCallback)
+{
+    _updateMinBatteryLevelPercent = minBatteryLevelPercent;
+    _updateRequireIdle = requireIdle;
+    _updatePolicyCallback = policyCallback;
+    checkUpdatePending();
+}
+
+// Declare whether the application is idle.
+void CloudClientDm::setUpdateIdle(bool idle)
+{
+    _updateIdle = idle;
+    checkUpdatePending();
+}
+
+// Set the firmware update progress callback.
+void CloudClientDm::setUpdateProgressCallback(Callback<void(int)> progressCallback)
+{
+    _updateProgressUserCallback = progressCallback;
+}
+
+// Set the minimum free heap for a firmware update download.
+void CloudClientDm::setUpdateMinHeapFree(int minHeapFreeBytes)
+{
+    _updateMinHeapFreeBytes = minHeapFreeBytes;
+    checkUpdatePending();
+}
+
+/**********************************************************************
+ * PUBLIC METHODS: QUEUE MODE
+ **********************************************************************/
+
+// Switch queue mode on or off.
+void CloudClientDm::setQueueMode(bool on, Callback<void()> sleepCallback)
+{
+    _queueSleepUserCallback = sleepCallback;
+    _queueMode = on;
+    if (!on) {
+        _queuedResources = 0;
+    }
+}
+
+// Send a notification of each Device object resource recorded in queue mode.
+int CloudClientDm::flushQueue()
+{
+    uint32_t queued = 0;
+    M2MResource *resource;
+    int numFlushed = 0;
+    int delayMs = 0;
+
+    if (_registered && (_deviceObject != NULL)) {
+        core_util_critical_section_enter();
+        queued = _queuedResources;
+        _queuedResources = 0;
+        delayMs = _bootTimer.read_ms() - _queuedSinceMs;
+        core_util_critical_section_exit();
+    }
+
+    // Critical first, then normal, then bulk, each in the usual order
+    for (unsigned int priority = 0; (priority < MAX_NUM_UPDATE_PRIORITIES) && (queued != 0); priority++) {
+        for (unsigned int x = 0; (x < sizeof(queueFlushOrder) / sizeof(queueFlushOrder[0])) && (queued != 0); x++) {
+            if ((queued & (1UL << queueFlushOrder[x])) &&
+                (_updatePriority[queueFlushOrder[x]] == priority)) {
+                queued &= ~(1UL << queueFlushOrder[x]);
+                resource = _deviceObject->get_resource(queueFlushOrder[x]);
+                // Only resources the server is observing will be sent
+                if ((resource != NULL) && (resource->report_handler() != NULL)) {
+                    resource->report_handler()->set_notification_trigger();
+                    recordUpdateSent((UpdatePriority) priority, delayMs);
+                    numFlushed++;
+                }
+            }
+        }
+    }
+
+    if (numFlushed > 0) {
+        setRadioOperation(RADIO_OP_DEVICE_OBJECT);
+        _stats.numQueueFlushed += numFlushed;
+        printfLog("Flushed %d queued resource(s).\n", numFlushed);
+    }
+
+    return numFlushed;
+}
+
+/**********************************************************************
+ * PUBLIC METHODS: HISTORY
+ **********************************************************************/
+
+// Keep a compressed history of the power source values.
+bool CloudClientDm::enableDeviceObjectHistory(bool spillToStorage)
+{
+    M2MObjectInstance *objectInstance;
+
+    if (!_started && (_historyResource == NULL)) {
+        objectInstance = createObject(CLOUD_CLIENT_HISTORY_OBJECT_NAME);
+        _historyResource = createResource(objectInstance, "0", M2MResourceInstance::OPAQUE,
+                                          M2MBase::GET_ALLOWED);
+        if (_historyResource != NULL) {
+            // The server fetches history when it wants it
+            _historyResource->set_observable(false);
+            _historyEnabled = true;
+            _historySpill = spillToStorage;
+            _historyTimer.start();
+            // Catch up with any power sources that already exist
+            for (uint16_t x = 0; x < sizeof(_powerSourceInstance) / sizeof(_powerSourceInstance[0]); x++) {
+                if (_powerSourceInstance[x] != POWER_SOURCE_UNUSED) {
+                    createHistory(x);
+                }
+            }
+        }
     }
 
-    return true;
+    return _historyEnabled;
 }
 
-// Close the cloud client and release its objects,
-// deregistering from the server.
-void CloudClientDm::stop()
-{
-    Timer timer;
+/**********************************************************************
+ * PUBLIC METHODS: CUSTOM OBJECTS
+ **********************************************************************/
 
-    // This is an asynchronous operation,
-    // the connection is not closed until
-    // clientDeregisteredCallback() is called
-    timer.start();
-    _cloudClient.close();
-    while (_registered && (timer.read_ms() < CLOUD_CLIENT_STOP_TIMEOUT_SECONDS * 1000))  {
-        wait_ms(100);
-    }
+// Create a custom object owned by us.
+M2MObjectInstance *CloudClientDm::addCustomObject(const char *name)
+{
+    M2MObjectInstance *objectInstance = NULL;
 
-    // Delete the available power source and associated Device object
-    // resources that have been created
-    for (uint16_t x = 0; (x < sizeof(_powerSourceInstance) / sizeof (_powerSourceInstance[0])); x++) {
-        if (_powerSourceInstance[x] != POWER_SOURCE_UNUSED) {
-            deleteDeviceObjectResource(M2MDevice::AvailablePowerSources, x);
-            deleteDeviceObjectResource(M2MDevice::PowerSourceVoltage, x);
-            deleteDeviceObjectResource(M2MDevice::PowerSourceCurrent, x);
-            _powerSourceInstance[x] = POWER_SOURCE_UNUSED;
-        }
+    if (!_started) {
+        objectInstance = createObject(name);
     }
 
-    // Everything else will be freed when we are deleted
+    return objectInstance;
 }
 
-// Connect the Mbed Cloud Client with the server.
-bool CloudClientDm::connect(void *interface)
+// Write the values set through the custom resource handles.
+int CloudClientDm::flushResources()
 {
-    bool success = false;
+    int numWritten = 0;
 
-    if (_started) {
-        success = _cloudClient.setup(interface);
+    for (ResourceHandleBase *handle = _resourceHandleList; handle != NULL; handle = handle->_next) {
+        if (handle->flush()) {
+            numWritten++;
+        }
+    }
 
-#ifdef MBED_CLOUD_CLIENT_SUPPORT_UPDATE
-        /* Set callback functions for authorizing updates and monitoring progress.
-           Code is implemented in update_ui_example.cpp
-           Both callbacks are completely optional. If no authorization callback
-           is set, the update process will procede immediately in each step.
-        */
-        update_ui_set_cloud_client(&_cloudClient);
-        // TODO
-        //_cloudClient.set_update_authorize_handler(update_authorize);
-        //_cloudClient.set_update_progress_handler(update_progress);
-#endif
+    if ((numWritten > 0) && _registered) {
+        setRadioOperation(RADIO_OP_CUSTOM_OBJECT);
     }
 
-    return success;
+    return numWritten;
 }
 
-// Return true if the cloud client is connected to the server.
-bool CloudClientDm::isConnected()
+/**********************************************************************
+ * PUBLIC METHODS: BATCH PUBLISHING
+ **********************************************************************/
+
+// Enable publishing of batches of resources.
+bool CloudClientDm::enableBatch()
 {
-    return _registered;
+    M2MObjectInstance *objectInstance;
+
+    if (!_started && (_batchResource == NULL)) {
+        objectInstance = createObject(CLOUD_CLIENT_BATCH_OBJECT_NAME);
+        _batchResource = createResource(objectInstance, "0", M2MResourceInstance::OPAQUE,
+                                        M2MBase::GET_ALLOWED);
+    }
+
+    return (_batchResource != NULL);
 }
 
-// Keep a UDP link up
-void CloudClientDm::keepAlive()
+// Publish the current values of a set of resources as one payload.
+int CloudClientDm::publishBatch(M2MResourceInstance * const *resources, int numResources,
+                                bool includePowerSources)
 {
-    _cloudClient.keep_alive();
+    M2MResourceInstance *powerSourceResources[MAX_NUM_POWER_SOURCES * 2];
+    M2MResource *voltage = NULL;
+    M2MResource *current = NULL;
+    int numPowerSourceResources = 0;
+    int resourceBytes = 0;
+    int length = -1;
+    int x;
+    uint8_t *buffer;
+    uint8_t *p;
+    Timer encodeTimer;
+    HeapMark heapMark;
+
+    heapTagBegin(&heapMark);
+    if ((_batchResource != NULL) && (_memoryShedLevel < MEMORY_SHED_METRICS)) {
+        encodeTimer.start();
+
+        if (includePowerSources) {
+            voltage = _deviceObject->get_resource(M2MDevice::PowerSourceVoltage);
+            current = _deviceObject->get_resource(M2MDevice::PowerSourceCurrent);
+            for (x = 0; x < (int) (sizeof(_powerSourceInstance) / sizeof(_powerSourceInstance[0])); x++) {
+                if (_powerSourceInstance[x] != POWER_SOURCE_UNUSED) {
+                    if ((voltage != NULL) && (voltage->resource_instance(x) != NULL)) {
+                        powerSourceResources[numPowerSourceResources] = voltage->resource_instance(x);
+                        numPowerSourceResources++;
+                    }
+                    if ((current != NULL) && (current->resource_instance(x) != NULL)) {
+                        powerSourceResources[numPowerSourceResources] = current->resource_instance(x);
+                        numPowerSourceResources++;
+                    }
+                }
+            }
+        }
+
+        // Work out the length, then encode for real
+        length = encodeCborHead(NULL, 4, numResources + numPowerSourceResources);
+        for (x = 0; x < numResources + numPowerSourceResources; x++) {
+            M2MResourceInstance *resource = x < numResources ? resources[x] : powerSourceResources[x - numResources];
+            length += encodeBatchRecord(NULL, resource);
+            resourceBytes += resource->value_length();
+        }
+        buffer = (uint8_t *) malloc(length);
+        if (buffer != NULL) {
+            p = buffer + encodeCborHead(buffer, 4, numResources + numPowerSourceResources);
+            for (x = 0; x < numResources + numPowerSourceResources; x++) {
+                p += encodeBatchRecord(p, x < numResources ? resources[x] : powerSourceResources[x - numResources]);
+            }
+            _stats.lastBatchEncodeUs = encodeTimer.read_us();
+            if (_batchResource->set_value(buffer, length)) {
+                setRadioOperation(RADIO_OP_CUSTOM_OBJECT);
+                _stats.numBatches++;
+                _stats.lastBatchBytes = length;
+                _stats.lastBatchResourceBytes = resourceBytes;
+                printfLog("Published batch of %d resource(s), %d byte(s) (%d byte(s) as individual resources), encoded in %d us.\n",
+                          numResources + numPowerSourceResources, length, resourceBytes,
+                          _stats.lastBatchEncodeUs);
+            } else {
+                length = -1;
+                printfLogError("Error setting batch resource.\n");
+            }
+            free(buffer);
+        } else {
+            printfLogError("Error allocating %d byte(s) for batch.\n", length);
+            length = -1;
+        }
+    }
+
+    heapTagEnd(HEAP_TAG_BUFFERS, &heapMark);
+    return length;
 }
 
 /**********************************************************************
- * PUBLIC METHODS: DEVICE OBJECT
+ * PUBLIC METHODS: NETWORK ATTACH
  **********************************************************************/
 
-// Set the Device object Device Type resource.
-bool CloudClientDm::setDeviceObjectStaticDeviceType(const char *deviceType)
+// Bring up a network interface in the background.
+bool CloudClientDm::attachNetwork(NetworkInterface *interface)
 {
-    return setDeviceObjectConfigResource(M2MDevice::DeviceType, deviceType);
-}
+    if ((_attachThread == NULL) && (interface != NULL)) {
+        _attachInterface = interface;
+        _attachThread = new Thread(osPriorityNormal, CLOUD_CLIENT_ATTACH_THREAD_STACK_SIZE);
+        if (_attachThread->start(callback(this, &CloudClientDm::attachNetworkThread)) != osOK) {
+            printfLogError("Error starting network attach thread.\n");
+            delete _attachThread;
+            _attachThread = NULL;
+        }
+    }
 
-// Set the Device object Serial Number resource.
-bool CloudClientDm::setDeviceObjectStaticSerialNumber(const char *serialNumber)
-{
-    return setDeviceObjectConfigResource(M2MDevice::SerialNumber, serialNumber);
+    return (_attachThread != NULL);
 }
 
-// Set the Device object Hardware Version resource.
-bool CloudClientDm::setDeviceObjectStaticHardwareVersion(const char *hardwareVersion)
+/**********************************************************************
+ * PUBLIC METHODS: POWER POLICY
+ **********************************************************************/
+
+// Scale our radio usage with the state of the power supply.
+bool CloudClientDm::setPowerPolicy(const PowerPolicy *table, int numEntries)
 {
-    return setDeviceObjectConfigResource(M2MDevice::HardwareVersion, hardwareVersion);
+    if (table == NULL) {
+        table = defaultPowerPolicyTable;
+        if (numEntries < 0) {
+            numEntries = sizeof(defaultPowerPolicyTable) / sizeof(defaultPowerPolicyTable[0]);
+        }
+    }
+
+    if (numEntries >= 0) {
+        _powerPolicyTable = table;
+        _powerPolicyNumEntries = numEntries;
+        updatePowerPolicy();
+    }
+
+    return (numEntries >= 0);
 }
 
-// Set the Device object Software Version resource.
-bool CloudClientDm::setDeviceObjectSoftwareVersion(const char *softwareVersion)
+// Get the power policy table entry currently in force.
+const CloudClientDm::PowerPolicy *CloudClientDm::getPowerPolicy()
 {
-    return setDeviceObjectResource(M2MDevice::SoftwareVersion, softwareVersion);
+    return _powerPolicy;
 }
 
-// Set the Device object Firmware Version resource.
-bool CloudClientDm::setDeviceObjectFirmwareVersion(const char *firmwareVersion)
+/**********************************************************************
+ * PUBLIC METHODS: SNAPSHOT
+ **********************************************************************/
+
+// Capture our state.
+bool CloudClientDm::snapshot(Snapshot *snapshot)
 {
-    return setDeviceObjectResource(M2MDevice::FirmwareVersion, firmwareVersion);
+    M2MDevice::DeviceResource resource;
+    String string;
+
+    if ((snapshot == NULL) || (_deviceObject == NULL)) {
+        return false;
+    }
+
+    memset(snapshot, 0, sizeof(*snapshot));
+    snapshot->magic = SNAPSHOT_MAGIC;
+    snapshot->version = SNAPSHOT_VERSION;
+    snapshot->size = sizeof(*snapshot);
+
+    for (uint16_t x = 0; x < sizeof(_powerSourceInstance) / sizeof (_powerSourceInstance[0]); x++) {
+        snapshot->powerSourceInstance[x] = (uint8_t) _powerSourceInstance[x];
+        if (_powerSourceInstance[x] != POWER_SOURCE_UNUSED) {
+            snapshot->voltageMV[x] = (int32_t) _deviceObject->resource_value_int(M2MDevice::PowerSourceVoltage, x);
+            snapshot->currentMA[x] = (int32_t) _deviceObject->resource_value_int(M2MDevice::PowerSourceCurrent, x);
+        }
+    }
+
+    if (_deviceObject->is_resource_present(M2MDevice::BatteryLevel)) {
+        snapshot->presentResources |= 1UL << M2MDevice::BatteryLevel;
+        snapshot->batteryLevelPercent = (int32_t) _deviceObject->resource_value_int(M2MDevice::BatteryLevel);
+    }
+    if (_deviceObject->is_resource_present(M2MDevice::BatteryStatus)) {
+        snapshot->presentResources |= 1UL << M2MDevice::BatteryStatus;
+        snapshot->batteryStatus = (int32_t) _deviceObject->resource_value_int(M2MDevice::BatteryStatus);
+    }
+    if (_deviceObject->is_resource_present(M2MDevice::ErrorCode)) {
+        snapshot->presentResources |= 1UL << M2MDevice::ErrorCode;
+        snapshot->errorCode = (int32_t) _deviceObject->resource_value_int(M2MDevice::ErrorCode);
+    }
+    if (_deviceObject->is_resource_present(M2MDevice::MemoryTotal)) {
+        snapshot->presentResources |= 1UL << M2MDevice::MemoryTotal;
+        snapshot->memoryTotalKBytes = _deviceObject->resource_value_int(M2MDevice::MemoryTotal);
+    }
+    if (_deviceObject->is_resource_present(M2MDevice::MemoryFree)) {
+        snapshot->presentResources |= 1UL << M2MDevice::MemoryFree;
+        snapshot->memoryFreeKBytes = _deviceObject->resource_value_int(M2MDevice::MemoryFree);
+    }
+
+    for (unsigned int x = 0; x < sizeof(snapshotStringResource) / sizeof(snapshotStringResource[0]); x++) {
+        resource = snapshotStringResource[x];
+        if (_deviceObject->is_resource_present(resource)) {
+            snapshot->presentResources |= 1UL << resource;
+            string = _deviceObject->resource_value_string(resource);
+            strncpy(snapshot->string[x], string.c_str(), sizeof(snapshot->string[x]) - 1);
+        }
+    }
+
+    snapshot->crc = crc32((const uint8_t *) snapshot, offsetof(Snapshot, crc));
+
+    return true;
 }
 
-// Add a Device object Available Power Source resource.
-bool CloudClientDm::addDeviceObjectPowerSource(PowerSource powerSource)
+// Apply a snapshot.
+bool CloudClientDm::restore(const Snapshot *snapshot)
 {
     bool success = false;
-    bool foundFree = false;
-    uint16_t x;
 
-    // Find a spare instance ID
-    for (x = 0; (x < sizeof(_powerSourceInstance) / sizeof (_powerSourceInstance[0])) && !foundFree; x++) {
-        if (_powerSourceInstance[x] == POWER_SOURCE_UNUSED) {
-            foundFree = true;
+    if (!_started && (snapshot != NULL) &&
+        (snapshot->magic == SNAPSHOT_MAGIC) &&
+        (snapshot->version == SNAPSHOT_VERSION) &&
+        (snapshot->size == sizeof(*snapshot)) &&
+        (snapshot->crc == crc32((const uint8_t *) snapshot, offsetof(Snapshot, crc)))) {
+        success = true;
+
+        for (unsigned int x = 0; x < sizeof(snapshotStringResource) / sizeof(snapshotStringResource[0]); x++) {
+            if (snapshot->presentResources & (1UL << snapshotStringResource[x])) {
+                // snapshot() always leaves room for the terminator
+                success = setDeviceObjectResource(snapshotStringResource[x],
+                                                  (const char *) snapshot->string[x]) && success;
+            }
         }
-    }
 
-    // Create the Available Power Source, Voltage and Current
-    // for that instance
-    if (foundFree) {
-        x--;
-        _powerSourceInstance[x] = powerSource;
-        success = createDeviceObjectResource(M2MDevice::AvailablePowerSources, (int64_t) powerSource, x) &&
-                  createDeviceObjectResource(M2MDevice::PowerSourceVoltage, (int64_t) 0, x) &&
-                  createDeviceObjectResource(M2MDevice::PowerSourceCurrent, (int64_t) 0, x);
-        // For internal battery, only, add the status and percentage remaining resources
-        if (success && (powerSource == POWER_SOURCE_INTERNAL_BATTERY)) {
-            success = createDeviceObjectResource(M2MDevice::BatteryLevel, (int64_t) 0) &&
-                      createDeviceObjectResource(M2MDevice::BatteryStatus, (int64_t) 0);
+        // Power sources go back in the same instances
+        // so that the server sees the same Device object
+        for (uint16_t x = 0; x < sizeof(_powerSourceInstance) / sizeof (_powerSourceInstance[0]); x++) {
+            if ((snapshot->powerSourceInstance[x] != POWER_SOURCE_UNUSED) &&
+                (_powerSourceInstance[x] == POWER_SOURCE_UNUSED)) {
+                success = createPowerSourceInstance((PowerSource) snapshot->powerSourceInstance[x], x) &&
+                          setDeviceObjectResource(M2MDevice::PowerSourceVoltage, (int64_t) snapshot->voltageMV[x], x) &&
+                          setDeviceObjectResource(M2MDevice::PowerSourceCurrent, (int64_t) snapshot->currentMA[x], x) &&
+                          success;
+            }
+        }
+
+        if (snapshot->presentResources & (1UL << M2MDevice::BatteryLevel)) {
+            success = setDeviceObjectBatteryLevel(snapshot->batteryLevelPercent) && success;
+        }
+        if (snapshot->presentResources & (1UL << M2MDevice::BatteryStatus)) {
+            success = setDeviceObjectBatteryStatus((BatteryStatus) snapshot->batteryStatus) && success;
+        }
+        if (snapshot->presentResources & (1UL << M2MDevice::ErrorCode)) {
+            success = setDeviceObjectErrorCode((Error) snapshot->errorCode) && success;
         }
+        if (snapshot->presentResources & (1UL << M2MDevice::MemoryTotal)) {
+            success = setDeviceObjectMemoryTotal(snapshot->memoryTotalKBytes) && success;
+        }
+        if (snapshot->presentResources & (1UL << M2MDevice::MemoryFree)) {
+            success = setDeviceObjectMemoryFree(snapshot->memoryFreeKBytes) && success;
+        }
+
+        printfLog("Restored snapshot (%s).\n", success ? "OK" : "with errors");
+    } else {
+        printfLogError("Error restoring snapshot: not valid or already started.\n");
     }
 
     return success;
 }
 
-// Check if a Device object Available Power Source resource of a given type
-// already exists
-bool CloudClientDm::existsDeviceObjectPowerSource(PowerSource powerSource)
-{
-    bool foundIt = false;
+/**********************************************************************
+ * PUBLIC METHODS: EVENTS
+ **********************************************************************/
 
-    // Find the instance ID
-    for (unsigned int x = 0; (x < sizeof(_powerSourceInstance) / sizeof (_powerSourceInstance[0])) && !foundIt; x++) {
-        if (_powerSourceInstance[x] == powerSource) {
-            foundIt = true;
+// Subscribe to events.
+int CloudClientDm::subscribe(Callback<void(Event, int)> callback, uint32_t eventMask,
+                             EventQueue *queue)
+{
+    int subscriberId = -1;
+
+    if (callback && ((eventMask & EVENT_ALL) != 0)) {
+        // publishEvent() may be running in the Mbed Cloud Client's thread
+        core_util_critical_section_enter();
+        for (unsigned int x = 0; (x < sizeof(_subscriber) / sizeof(_subscriber[0])) && (subscriberId < 0); x++) {
+            if (_subscriber[x].eventMask == 0) {
+                _subscriber[x].callback = callback;
+                _subscriber[x].queue = queue;
+                _subscriber[x].eventMask = eventMask & EVENT_ALL;
+                subscriberId = x;
+            }
         }
+        core_util_critical_section_exit();
     }
 
-    return foundIt;
+    if (subscriberId < 0) {
+        printfLogError("Error subscribing to events.\n");
+    }
+
+    return subscriberId;
 }
 
-// Delete a Device object Available Power Source resource.
-bool CloudClientDm::deleteDeviceObjectPowerSource(PowerSource powerSource)
+// Unsubscribe from events.
+bool CloudClientDm::unsubscribe(int subscriberId)
 {
     bool success = false;
-    bool foundIt = false;
-    uint16_t x;
 
-    // Find the instance ID
-    for (x = 0; (x < sizeof(_powerSourceInstance) / sizeof (_powerSourceInstance[0])) && !foundIt; x++) {
-        if (_powerSourceInstance[x] == powerSource) {
-            foundIt = true;
+    if ((subscriberId >= 0) && (subscriberId < (int) (sizeof(_subscriber) / sizeof(_subscriber[0])))) {
+        // publishEvent() may be running in the Mbed Cloud Client's thread
+        core_util_critical_section_enter();
+        if (_subscriber[subscriberId].eventMask != 0) {
+            _subscriber[subscriberId].eventMask = 0;
+            _subscriber[subscriberId].callback = Callback<void(Event, int)>();
+            _subscriber[subscriberId].queue = NULL;
+            success = true;
         }
+        core_util_critical_section_exit();
     }
 
-    // Delete those Available Power Source, Voltage and Current instances
-    if (foundIt) {
-        x--;
-        if (deleteDeviceObjectResource(M2MDevice::AvailablePowerSources, x) &&
-            deleteDeviceObjectResource(M2MDevice::PowerSourceVoltage, x) &&
-            deleteDeviceObjectResource(M2MDevice::PowerSourceCurrent, x)) {
-            _powerSourceInstance[x] = POWER_SOURCE_UNUSED;
+    return success;
+}
+
+/**********************************************************************
+ * PUBLIC METHODS: WRITE HANDLERS
+ **********************************************************************/
+
+// Set a handler for writes by the server.
+bool CloudClientDm::setWriteHandler(Callback<void(M2MBase *)> handler, uint16_t objectId,
+                                    int instanceId, int resourceId)
+{
+    bool success = false;
+    int x;
+
+    // A resource handler must say which instance it is for
+    if ((resourceId < 0) || (instanceId >= 0)) {
+        x = findWriteHandler(writeHandlerKey(objectId, instanceId, resourceId), (bool) handler);
+        if (x >= 0) {
+            _writeHandler[x].handler = handler;
+            if (_started) {
+                bindWriteHandlers();
+            }
+            success = true;
+        } else if (handler) {
+            printfLogError("Error setting write handler, table full.\n");
+        } else {
+            // Nothing to remove
             success = true;
-        }
-        // For internal battery, also delete the status and percentage remaining resources
-        if (success && (powerSource == POWER_SOURCE_INTERNAL_BATTERY)) {
-            success = deleteDeviceObjectResource(M2MDevice::BatteryLevel) &&
-                      deleteDeviceObjectResource(M2MDevice::BatteryStatus);
         }
     }
 
     return success;
 }
 
-// Set the Device object Power Source Voltage resource.
-bool CloudClientDm::setDeviceObjectVoltage(PowerSource powerSource, int voltageMV)
+/**********************************************************************
+ * PUBLIC METHODS: RADIO ENERGY
+ **********************************************************************/
+
+// Switch radio energy accounting on or off.
+void CloudClientDm::setRadioAccounting(bool on, const RadioCosts *costs)
 {
-    bool success = false;
-    bool foundIt = false;
-    uint16_t x;
+    if (costs != NULL) {
+        _radioCosts = *costs;
+    } else {
+        _radioCosts = defaultRadioCosts;
+    }
+    _radioLastPacketMs = -1;
+    _radioAccounting = on;
+}
 
-     // Find the instance ID
-     for (x = 0; (x < sizeof(_powerSourceInstance) / sizeof (_powerSourceInstance[0])) && !foundIt; x++) {
-         if (_powerSourceInstance[x] == powerSource) {
-             foundIt = true;
-         }
-     }
+// Get the radio usage attributed to an operation.
+bool CloudClientDm::getRadioStats(RadioOperation operation, RadioStats *stats)
+{
+    bool success = false;
 
-     if (foundIt) {
-         x--;
-         success = setDeviceObjectResource(M2MDevice::PowerSourceVoltage, (int64_t) voltageMV, x);
-     }
+    if ((operation < MAX_NUM_RADIO_OPS) && (stats != NULL)) {
+        core_util_critical_section_enter();
+        *stats = _radioStats[operation];
+        core_util_critical_section_exit();
+        success = true;
+    }
 
     return success;
 }
 
-// Set the Device object Power Source Current resource.
-bool CloudClientDm::setDeviceObjectCurrent(PowerSource powerSource, int currentMA)
+/**********************************************************************
+ * PUBLIC METHODS: UPDATE PRIORITY
+ **********************************************************************/
+
+// Set the priority class of a Device object resource.
+bool CloudClientDm::setUpdatePriority(M2MDevice::DeviceResource resource,
+                                      UpdatePriority priority)
 {
     bool success = false;
-    bool foundIt = false;
-    uint16_t x;
-
-     // Find the instance ID
-     for (x = 0; (x < sizeof(_powerSourceInstance) / sizeof (_powerSourceInstance[0])) && !foundIt; x++) {
-         if (_powerSourceInstance[x] == powerSource) {
-             foundIt = true;
-         }
-     }
 
-     if (foundIt) {
-         x--;
-         success = setDeviceObjectResource(M2MDevice::PowerSourceCurrent, (int64_t) currentMA, x);
-     }
+    if (((unsigned int) resource < sizeof(_updatePriority)) &&
+        (priority < MAX_NUM_UPDATE_PRIORITIES)) {
+        _updatePriority[resource] = (uint8_t) priority;
+        success = true;
+    }
 
     return success;
 }
 
-// Set the Device object Battery Level resource.
-bool CloudClientDm::setDeviceObjectBatteryLevel(int batteryLevelPercent)
+// Get the priority class of a Device object resource.
+CloudClientDm::UpdatePriority CloudClientDm::getUpdatePriority(M2MDevice::DeviceResource resource)
 {
-    return setDeviceObjectResource(M2MDevice::BatteryLevel, (int64_t) batteryLevelPercent);
-}
+    UpdatePriority priority = UPDATE_PRIORITY_NORMAL;
 
-// Set the Device object Battery Status resource.
-bool CloudClientDm::setDeviceObjectBatteryStatus(CloudClientDm::BatteryStatus batteryStatus)
-{
-    return setDeviceObjectResource(M2MDevice::BatteryStatus, (int64_t) batteryStatus);
-}
+    if ((unsigned int) resource < sizeof(_updatePriority)) {
+        priority = (UpdatePriority) _updatePriority[resource];
+    }
 
-// Set the Device object Memory Total resource.
-bool CloudClientDm::setDeviceObjectMemoryTotal(int64_t memoryTotalKBytes)
-{
-    return setDeviceObjectResource(M2MDevice::MemoryTotal, memoryTotalKBytes);
+    return priority;
 }
 
-// Set the Device object Memory Free resource.
-bool CloudClientDm::setDeviceObjectMemoryFree(int64_t memoryFreeKBytes)
+// Write the updates held back by their priority class.
+int CloudClientDm::flushUpdates(int maxNumUpdates)
 {
-    return setDeviceObjectResource(M2MDevice::MemoryFree, memoryFreeKBytes);
-}
+    PendingUpdate *pendingUpdate;
+    M2MDevice::DeviceResource resource;
+    int nowMs = _bootTimer.read_ms();
+    int best;
+    int delayMs;
+    bool success;
+    int numFlushed = 0;
+
+    do {
+        // Only bulk updates are held back, so simply
+        // take the one that has waited longest
+        best = -1;
+        for (unsigned int x = 0; x < sizeof(_pendingUpdate) / sizeof(_pendingUpdate[0]); x++) {
+            if (_pendingUpdate[x].used &&
+                ((best < 0) || (_pendingUpdate[x].enqueuedMs < _pendingUpdate[best].enqueuedMs))) {
+                best = x;
+            }
+        }
 
-// Set the Device object Error Code resource.
-bool CloudClientDm::setDeviceObjectErrorCode(CloudClientDm::Error errorCode)
-{
-    return setDeviceObjectResource(M2MDevice::ErrorCode, (int64_t) errorCode, 0);
+        if ((best >= 0) && (_deviceObject != NULL)) {
+            pendingUpdate = &(_pendingUpdate[best]);
+            pendingUpdate->used = false;
+            resource = (M2MDevice::DeviceResource) pendingUpdate->resource;
+            delayMs = nowMs - pendingUpdate->enqueuedMs;
+            if (pendingUpdate->instance < 0) {
+                success = _deviceObject->set_resource_value(resource, pendingUpdate->value);
+            } else {
+                success = _deviceObject->set_resource_value(resource, pendingUpdate->value,
+                                                            pendingUpdate->instance);
+            }
+            if (success) {
+                _stats.numUpdates++;
+                queueDeviceObjectResource(resource, delayMs);
+            } else {
+                _stats.numUpdateFailures++;
+                printfLogError("Error writing held-back update of \"%s\", instance %d, on the Device object.\n",
+                               deviceObjectResourceString[resource], pendingUpdate->instance);
+            }
+            numFlushed++;
+        }
+    } while ((best >= 0) && ((maxNumUpdates < 0) || (numFlushed < maxNumUpdates)));
+
+    return numFlushed;
 }
 
-// Set the Device object UTC Offset resource.
-bool CloudClientDm::setDeviceObjectUtcOffset(const char *utcOffsetISO8601)
+/**********************************************************************
+ * PUBLIC METHODS: MEMORY PRESSURE
+ **********************************************************************/
+
+// Set the free heap watermarks at which optional features are shed.
+void CloudClientDm::setMemoryWatermarks(int lowFreeBytes, int criticalFreeBytes)
 {
-    return setDeviceObjectResource(M2MDevice::UTCOffset, utcOffsetISO8601);
+    _memoryLowFreeBytes = lowFreeBytes;
+    _memoryCriticalFreeBytes = criticalFreeBytes;
+    if (lowFreeBytes < 0) {
+        setMemoryShedLevel(MEMORY_SHED_NONE, -1);
+    }
 }
 
-// Set the Device object Timezone resource.
-bool CloudClientDm::setDeviceObjectTimezone(const char *timezoneIANA)
+// Get how much has been shed under memory pressure.
+CloudClientDm::MemoryShedLevel CloudClientDm::getMemoryShedLevel()
 {
-    return setDeviceObjectResource(M2MDevice::Timezone, timezoneIANA);
+    return _memoryShedLevel;
 }
 
 // End of file
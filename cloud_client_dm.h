@@ -17,6 +17,7 @@
 #ifndef _CLOUD_CLIENT_DM_
 #define _CLOUD_CLIENT_DM_
 
+#include <algorithm>
 #include "mbed.h"
 #include "MbedCloudClient.h"
 
@@ -58,6 +59,154 @@ public:
      */
 #   define CLOUD_CLIENT_STOP_TIMEOUT_SECONDS 10
 
+    /** How long connect() with a list of interfaces waits for
+     * registration over each interface before moving on to the next.
+     */
+#   ifndef CLOUD_CLIENT_CONNECT_TIMEOUT_SECONDS
+#   define CLOUD_CLIENT_CONNECT_TIMEOUT_SECONDS 120
+#   endif
+
+    /** The maximum number of interfaces that connect() with a list
+     * of interfaces will try, and remembers the registration latency of.
+     */
+#   ifndef CLOUD_CLIENT_MAX_NUM_INTERFACES
+#   define CLOUD_CLIENT_MAX_NUM_INTERFACES 4
+#   endif
+
+    /** The shortest period over which link throughput is measured
+     * (see getLinkQuality()).
+     */
+#   ifndef CLOUD_CLIENT_LINK_QUALITY_WINDOW_SECONDS
+#   define CLOUD_CLIENT_LINK_QUALITY_WINDOW_SECONDS 10
+#   endif
+
+    /** For radio energy accounting (see setRadioAccounting()), how
+     * long after an operation starts the traffic it causes is still
+     * attributed to it.
+     */
+#   ifndef CLOUD_CLIENT_RADIO_ATTRIBUTION_MS
+#   define CLOUD_CLIENT_RADIO_ATTRIBUTION_MS 2000
+#   endif
+
+    /** The number of updates that can be held back for the next
+     * scheduled flush (see setUpdatePriority()); when full, an
+     * update is written at once.
+     */
+#   ifndef CLOUD_CLIENT_MAX_NUM_PENDING_UPDATES
+#   define CLOUD_CLIENT_MAX_NUM_PENDING_UPDATES 16
+#   endif
+
+    /** The maximum number of held-back updates that keepAlive()
+     * writes in one go, so that a backlog of bulk data doesn't
+     * flood a slow link.
+     */
+#   ifndef CLOUD_CLIENT_MAX_UPDATES_PER_FLUSH
+#   define CLOUD_CLIENT_MAX_UPDATES_PER_FLUSH 8
+#   endif
+
+    /** The number of M2MDevice::DeviceResource types that
+     * per-resource tables are sized for; this is also the width of
+     * the bitmaps of Device object resources.
+     */
+#   define CLOUD_CLIENT_MAX_NUM_DEVICE_RESOURCES 32
+
+    /** How far free heap must climb above the low watermark before
+     * a shed feature is restored (see setMemoryWatermarks()).
+     */
+#   ifndef CLOUD_CLIENT_MEMORY_HYSTERESIS_BYTES
+#   define CLOUD_CLIENT_MEMORY_HYSTERESIS_BYTES 1024
+#   endif
+
+    /** The size of each of the two chunks of history kept, in RAM,
+     * for each power source (see enableDeviceObjectHistory()).
+     */
+#   ifndef CLOUD_CLIENT_HISTORY_CHUNK_SIZE
+#   define CLOUD_CLIENT_HISTORY_CHUNK_SIZE 128
+#   endif
+
+    /** The name of the companion object that exposes the history
+     * of the power sources; an ID from the OMA private range.
+     */
+#   ifndef CLOUD_CLIENT_HISTORY_OBJECT_NAME
+#   define CLOUD_CLIENT_HISTORY_OBJECT_NAME "26241"
+#   endif
+
+    /** The name of the companion object through which batches of
+     * resources are published (see publishBatch()).
+     */
+#   ifndef CLOUD_CLIENT_BATCH_OBJECT_NAME
+#   define CLOUD_CLIENT_BATCH_OBJECT_NAME "26242"
+#   endif
+
+    /** The stack size of the thread that brings up the network
+     * (see attachNetwork()); cellular drivers need plenty.
+     */
+#   ifndef CLOUD_CLIENT_ATTACH_THREAD_STACK_SIZE
+#   define CLOUD_CLIENT_ATTACH_THREAD_STACK_SIZE 4096
+#   endif
+
+    /** The space for each string resource in a Snapshot,
+     * including the terminator.
+     */
+#   ifndef CLOUD_CLIENT_SNAPSHOT_STRING_SIZE
+#   define CLOUD_CLIENT_SNAPSHOT_STRING_SIZE 32
+#   endif
+
+    /** Set to 1 to allow Device object strings that never change to be
+     * served from caller-provided storage through read callbacks (see
+     * setDeviceObjectConstString()); this needs an Mbed Cloud Client
+     * which provides M2MResourceBase::set_read_resource_function().
+     */
+#   ifndef CLOUD_CLIENT_DM_READ_CALLBACKS
+#   define CLOUD_CLIENT_DM_READ_CALLBACKS 0
+#   endif
+
+    /** The number of resources that setDeviceObjectConstString() can
+     * serve: Device Type, Serial Number, Hardware Version and
+     * Software Version.
+     */
+#   define CLOUD_CLIENT_MAX_NUM_CONST_STRINGS 4
+
+    /** The maximum number of event subscribers (see subscribe()).
+     */
+#   ifndef CLOUD_CLIENT_MAX_NUM_SUBSCRIBERS
+#   define CLOUD_CLIENT_MAX_NUM_SUBSCRIBERS 4
+#   endif
+
+    /** The number of entries in the table of write handlers (see
+     * setWriteHandler()); must be a power of two and, for speed,
+     * comfortably more than the number of handlers.
+     */
+#   ifndef CLOUD_CLIENT_WRITE_HANDLER_TABLE_SIZE
+#   define CLOUD_CLIENT_WRITE_HANDLER_TABLE_SIZE 32
+#   endif
+
+    /** Set to 1 with an Mbed Cloud Client which provides
+     * M2MBase::set_message_delivery_status_cb(), so that the drain
+     * phase of stop() can finish as soon as the server has
+     * acknowledged the outstanding notifications rather than
+     * always waiting for the deadline.
+     */
+#   ifndef CLOUD_CLIENT_DM_DELIVERY_STATUS
+#   define CLOUD_CLIENT_DM_DELIVERY_STATUS 0
+#   endif
+
+    /** Without CLOUD_CLIENT_DM_DELIVERY_STATUS, how long the drain
+     * phase of stop() gives the notifications to get out, at most,
+     * since it cannot tell when they have been acknowledged.
+     */
+#   ifndef CLOUD_CLIENT_DRAIN_SETTLE_MS
+#   define CLOUD_CLIENT_DRAIN_SETTLE_MS 1000
+#   endif
+
+    /** Set to 1, with MBED_HEAP_STATS_ENABLED defined, to attribute
+     * the heap taken by CloudClientDm's own code paths to a HeapTag
+     * (see getHeapTagStats()).
+     */
+#   ifndef CLOUD_CLIENT_DM_HEAP_TAGS
+#   define CLOUD_CLIENT_DM_HEAP_TAGS 0
+#   endif
+
     /** The possible battery status values (according to
      * the OMA LWM2M Device object standard)
      */
@@ -104,9 +253,621 @@ public:
         MAX_NUM_ERRORS
     } Error;
 
+    /** The possible network bearers (according to the OMA LWM2M
+     * Connectivity Monitoring object standard)
+     */
+    typedef enum {
+        NETWORK_BEARER_GSM = 0,
+        NETWORK_BEARER_TD_SCDMA = 1,
+        NETWORK_BEARER_WCDMA = 2,
+        NETWORK_BEARER_CDMA2000 = 3,
+        NETWORK_BEARER_WIMAX = 4,
+        NETWORK_BEARER_LTE_TDD = 5,
+        NETWORK_BEARER_LTE_FDD = 6,
+        NETWORK_BEARER_NB_IOT = 7,
+        NETWORK_BEARER_WLAN = 21,
+        NETWORK_BEARER_BLUETOOTH = 22,
+        NETWORK_BEARER_IEEE_802_15_4 = 23,
+        NETWORK_BEARER_ETHERNET = 41,
+        NETWORK_BEARER_DSL = 42,
+        NETWORK_BEARER_PLC = 43
+    } NetworkBearer;
+
+    /** The things that heap taken by CloudClientDm is attributed to
+     * (see CLOUD_CLIENT_DM_HEAP_TAGS).
+     */
+    typedef enum {
+        /** Device object and custom resources.
+         */
+        HEAP_TAG_RESOURCES,
+
+        /** String values set on the Device object.
+         */
+        HEAP_TAG_STRINGS,
+
+        /** Custom objects and the object list.
+         */
+        HEAP_TAG_OBJECTS,
+
+        /** History, batch and other buffers.
+         */
+        HEAP_TAG_BUFFERS,
+
+        /** The Mbed Cloud Client, in calls made by CloudClientDm.
+         */
+        HEAP_TAG_CLOUD_CLIENT,
+
+        MAX_NUM_HEAP_TAGS
+    } HeapTag;
+
+    /** The heap attributed to a HeapTag.  Figures are net of frees
+     * and are measured as the change in the heap statistics across
+     * each tagged code path, hence an allocation made by another
+     * thread at the same moment will be counted too; treat them as
+     * a guide to where growth comes from rather than an exact ledger.
+     */
+    typedef struct {
+        /** Bytes held now.
+         */
+        int currentBytes;
+
+        /** The most bytes ever held.
+         */
+        int peakBytes;
+
+        /** Heap blocks held now.
+         */
+        int numBlocks;
+
+        /** Tagged code paths run.
+         */
+        uint32_t numCalls;
+    } HeapTagStats;
+
+    /** How much has been shed under memory pressure (see
+     * setMemoryWatermarks()); each level includes those before it.
+     */
+    typedef enum {
+        /** Everything is running.
+         */
+        MEMORY_SHED_NONE,
+
+        /** History buffers freed, no history kept.
+         */
+        MEMORY_SHED_HISTORY,
+
+        /** Batch publishing paused, its buffer freed.
+         */
+        MEMORY_SHED_METRICS,
+
+        MAX_NUM_MEMORY_SHED_LEVELS
+    } MemoryShedLevel;
+
+    /** The priority classes of Device object resource updates (see
+     * setUpdatePriority()).
+     */
+    typedef enum {
+        /** Bypasses rate limits and goes first.
+         */
+        UPDATE_PRIORITY_CRITICAL,
+
+        /** Goes as soon as it is set.
+         */
+        UPDATE_PRIORITY_NORMAL,
+
+        /** Waits for keepAlive() or flushUpdates().
+         */
+        UPDATE_PRIORITY_BULK,
+
+        MAX_NUM_UPDATE_PRIORITIES
+    } UpdatePriority;
+
+    /** The updates sent in a priority class and how long they waited
+     * between being set and being sent.
+     */
+    typedef struct {
+        /** Updates sent.
+         */
+        uint32_t numSent;
+
+        /** Sum of their queueing delays.
+         */
+        uint32_t totalDelayMs;
+
+        /** Queueing delay of the last one, -1 if none.
+         */
+        int lastDelayMs;
+
+        /** The worst case of the above.
+         */
+        int maxDelayMs;
+    } UpdateClassStats;
+
+    /** Statistics on the operation of CloudClientDm, e.g. for
+     * monitoring it during a soak test.  Heap figures are only
+     * available if MBED_HEAP_STATS_ENABLED is defined, otherwise
+     * they are -1.
+     */
+    typedef struct {
+        /** Time since the statistics were reset.
+         */
+        int periodMs;
+
+        /** Calls to connect().
+         */
+        uint32_t numConnects;
+
+        /** Registrations with the server.
+         */
+        uint32_t numRegistrations;
+
+        /** Deregistrations from the server.
+         */
+        uint32_t numDeregistrations;
+
+        /** Errors reported by the Mbed Cloud Client.
+         */
+        uint32_t numErrors;
+
+        /** connect() to registered, -1 if never registered.
+         */
+        int lastRegistrationLatencyMs;
+
+        /** The worst case of the above.
+         */
+        int maxRegistrationLatencyMs;
+
+        /** Successful Device object resource updates.
+         */
+        uint32_t numUpdates;
+
+        /** Failed Device object resource updates.
+         */
+        uint32_t numUpdateFailures;
+
+        /** Resources flushed from the queue (see setQueueMode()).
+         */
+        uint32_t numQueueFlushed;
+
+        /** Device object changes sent to the server, as notifications
+         * of the resources it observes; divided by periodMs this is
+         * the notification throughput.
+         */
+        uint32_t numNotifications;
+
+        /** Heap in use when the statistics were reset.
+         */
+        int heapStartBytes;
+
+        /** Heap in use now.
+         */
+        int heapCurrentBytes;
+
+        /** Maximum heap ever in use.
+         */
+        int heapMaxBytes;
+
+        /** Failed heap allocations.
+         */
+        int heapAllocFailures;
+
+        /** Batches published (see publishBatch()).
+         */
+        uint32_t numBatches;
+
+        /** SenML-CBOR payload size of the last batch, -1 if none.
+         */
+        int lastBatchBytes;
+
+        /** The same values as individual resource payloads, -1 if none.
+         */
+        int lastBatchResourceBytes;
+
+        /** Time taken to encode the last batch, -1 if none.
+         */
+        int lastBatchEncodeUs;
+
+        /** Network attach time (see attachNetwork()), -1 if none.
+         */
+        int attachMs;
+
+        /** Construction to first registration, -1 if not yet.
+         */
+        int bootToRegisteredMs;
+
+        /** Events lost because a subscriber's queue was full.
+         */
+        uint32_t numEventsDropped;
+
+        /** Duration of the last drain in stop(), -1 if none.
+         */
+        int lastDrainMs;
+
+        /** Updates acknowledged during the last drain, -1 if none or
+         * unknown (CLOUD_CLIENT_DM_DELIVERY_STATUS is 0).
+         */
+        int lastDrainFlushed;
+
+        /** Updates not acknowledged by the deadline, -1 if none or
+         * unknown (CLOUD_CLIENT_DM_DELIVERY_STATUS is 0).
+         */
+        int lastDrainDropped;
+
+        /** Power sources added or deleted.
+         */
+        uint32_t numPlugEvents;
+
+        /** Time taken by the last add or delete, -1 if none.
+         */
+        int lastPlugUs;
+
+        /** The worst case of the above.
+         */
+        int maxPlugUs;
+
+        /** Heap by HeapTag (see getHeapTagStats()).
+         */
+        HeapTagStats heapTag[MAX_NUM_HEAP_TAGS];
+
+        /** Updates held back for the next keepAlive().
+         */
+        uint32_t numUpdatesDeferred;
+
+        /** The update statistics of each UpdatePriority.
+         */
+        UpdateClassStats updateClass[MAX_NUM_UPDATE_PRIORITIES];
+
+        /** Features shed under memory pressure.
+         */
+        uint32_t numMemoryShedSteps;
+
+        /** Features restored when memory recovered.
+         */
+        uint32_t numMemoryRestoreSteps;
+    } Stats;
+
+    /** The base of a typed resource handle (see addCustomResource()),
+     * which is all CloudClientDm needs to flush it.
+     */
+    class ResourceHandleBase {
+    public:
+        ResourceHandleBase(M2MResource *resource) : _resource(resource), _dirty(false), _next(NULL) {}
+        virtual ~ResourceHandleBase() {}
+
+        /** Get the resource behind this handle.
+         *
+         * @return a pointer to the resource.
+         */
+        M2MResource *resource() const
+        {
+            return _resource;
+        }
+
+        /** Write the cached value to the resource if it has been set
+         * since the last flush.
+         *
+         * @return true if the resource was written, otherwise false.
+         */
+        bool flush()
+        {
+            bool written = false;
+
+            if (_dirty) {
+                _dirty = false;
+                written = write();
+            }
+
+            return written;
+        }
+
+    protected:
+        friend class CloudClientDm;
+        virtual bool write() = 0;
+        M2MResource *_resource;
+        bool _dirty;
+        ResourceHandleBase *_next;
+    };
+
+    /** The mapping of a C++ type on to a resource type, used by
+     * ResourceHandle; int64_t, int, bool, float and std::string are
+     * supported.
+     */
+    template <typename T> struct ResourceTraits;
+
+    /** A typed handle on a resource of a custom object, holding the
+     * resource pointer and a cached value.  set() is a store plus
+     * a dirty flag; the value reaches the resource, and hence the
+     * server, when CloudClientDm flushes it (see flushResources()).
+     * set(), get() and the flush belong to the application's thread;
+     * a write from the server arrives in the Mbed Cloud Client's
+     * thread and is handed over under a critical section.
+     */
+    template <typename T>
+    class ResourceHandle : public ResourceHandleBase {
+    public:
+        ResourceHandle(M2MResource *resource) : ResourceHandleBase(resource), _value(),
+                                                _serverValue(), _serverWritten(false) {}
+
+        /** Set the value; this supersedes any write from the server
+         * not yet collected by get().
+         *
+         * @param value the value.
+         */
+        void set(const T &value)
+        {
+            core_util_critical_section_enter();
+            _serverWritten = false;
+            core_util_critical_section_exit();
+            if (!(value == _value)) {
+                _value = value;
+                _dirty = true;
+            }
+        }
+
+        /** Get the value, which includes any write from the server.
+         *
+         * @return the value.
+         */
+        const T &get() const
+        {
+            // A swap doesn't allocate, so is fine in a critical section
+            core_util_critical_section_enter();
+            if (_serverWritten) {
+                std::swap(_value, _serverValue);
+                _serverWritten = false;
+            }
+            core_util_critical_section_exit();
+
+            return _value;
+        }
+
+        /** Called by the Mbed Cloud Client when the server writes
+         * the resource.
+         */
+        void valueUpdated(const char *name)
+        {
+            T value = T();
+
+            (void) name;
+
+            // Read it outside the critical section, then hand it over;
+            // whatever comes back is freed, if need be, out here too
+            ResourceTraits<T>::read(_resource, &value);
+            core_util_critical_section_enter();
+            std::swap(_serverValue, value);
+            _serverWritten = true;
+            core_util_critical_section_exit();
+        }
+
+    protected:
+        virtual bool write()
+        {
+            return ResourceTraits<T>::write(_resource, get());
+        }
+
+        mutable T _value;
+        mutable T _serverValue;
+        mutable volatile bool _serverWritten;
+    };
+
+    /** The events that may be subscribed to, as a bit-map (see subscribe()).
+     */
+    typedef enum {
+        /** Registered with the server.
+         */
+        EVENT_REGISTERED = 0x01,
+
+        /** Deregistered from the server.
+         */
+        EVENT_DEREGISTERED = 0x02,
+
+        /** Registration updated (queue mode: woken up).
+         */
+        EVENT_REGISTRATION_UPDATED = 0x04,
+
+        /** An error, the parameter is the MbedCloudClient::Error or,
+         * for a failed network attach, the nsapi_error_t.
+         */
+        EVENT_ERROR = 0x08,
+
+        EVENT_ALL = 0x0F
+    } Event;
+
+    /** The estimated quality of the link to the server and the CoAP
+     * transfer parameters recommended for it (see getLinkQuality()).
+     */
+    typedef struct {
+        /** 100 for no exchanges lost, 0 for all lost.
+         */
+        int qualityPercent;
+
+        /** Recommended CoAP block size in bytes.
+         */
+        int blockSize;
+
+        /** Recommended CoAP ACK time-out.
+         */
+        int ackTimeoutSeconds;
+
+        /** Recommended CoAP retransmission count.
+         */
+        int maxRetransmissions;
+
+        /** Measured throughput, -1 if not known.
+         */
+        int throughputBytesPerSecond;
+    } LinkQuality;
+
+    /** An entry in the power policy table (see setPowerPolicy()).
+     */
+    typedef struct {
+        /** The entry applies at or above this internal battery level.
+         */
+        int minBatteryLevelPercent;
+
+        /** Minimum interval between keep-alives, 0 for no limit.
+         */
+        int keepAliveIntervalSeconds;
+
+        /** Minimum interval between reports of each power source value,
+         * 0 for no limit.
+         */
+        int minReportIntervalSeconds;
+
+        /** Voltage changes smaller than this wait for the report
+         * interval.
+         */
+        int voltageDeadbandMV;
+
+        /** Current changes smaller than this wait for the report
+         * interval.
+         */
+        int currentDeadbandMA;
+    } PowerPolicy;
+
+    /** The operations that radio traffic is attributed to (see
+     * setRadioAccounting()).
+     */
+    typedef enum {
+        /** connect() until registered or failed.
+         */
+        RADIO_OP_REGISTRATION,
+
+        /** keepAlive().
+         */
+        RADIO_OP_KEEP_ALIVE,
+
+        /** A Device object resource update.
+         */
+        RADIO_OP_DEVICE_OBJECT,
+
+        /** A resource handle, batch or history update.
+         */
+        RADIO_OP_CUSTOM_OBJECT,
+
+        /** A firmware update download.
+         */
+        RADIO_OP_FIRMWARE,
+
+        /** Anything else, e.g. server reads.
+         */
+        RADIO_OP_OTHER,
+
+        MAX_NUM_RADIO_OPS
+    } RadioOperation;
+
+    /** The cost of using the radio, for radio energy accounting.
+     * A wakeup is a packet after the radio has been idle for longer
+     * than tailMs, e.g. the RRC inactivity timer of a cellular modem;
+     * its cost should include connection set-up and the tail itself.
+     */
+    typedef struct {
+        /** Energy per byte sent.
+         */
+        uint32_t txNanoJoulesPerByte;
+
+        /** Energy per byte received.
+         */
+        uint32_t rxNanoJoulesPerByte;
+
+        /** Energy per wakeup of the radio.
+         */
+        uint32_t microJoulesPerWakeup;
+
+        /** Time the radio stays active after a packet.
+         */
+        int tailMs;
+    } RadioCosts;
+
+    /** The radio usage attributed to a RadioOperation.
+     */
+    typedef struct {
+        /** Bytes sent.
+         */
+        uint32_t txBytes;
+
+        /** Bytes received.
+         */
+        uint32_t rxBytes;
+
+        /** Packets sent.
+         */
+        uint32_t txPackets;
+
+        /** Packets received.
+         */
+        uint32_t rxPackets;
+
+        /** Times the radio was woken up.
+         */
+        uint32_t numWakeups;
+
+        /** Estimated time the radio was active.
+         */
+        uint32_t activeMs;
+
+        /** Estimated energy, from the RadioCosts.
+         */
+        uint64_t energyMicroJoules;
+    } RadioStats;
+
+    /** The Device object strings held in a Snapshot.
+     */
+    typedef enum {
+        SNAPSHOT_STRING_SOFTWARE_VERSION = 0,
+        SNAPSHOT_STRING_FIRMWARE_VERSION = 1,
+        SNAPSHOT_STRING_UTC_OFFSET = 2,
+        SNAPSHOT_STRING_TIMEZONE = 3,
+        NUM_SNAPSHOT_STRINGS
+    } SnapshotString;
+
+    /** The state of CloudClientDm, as captured by snapshot(), e.g. in
+     * a retained-RAM section, and applied by restore().  Resources
+     * that CloudClientDm keeps in Cloud Client storage (the "Static"
+     * ones) are not included since they survive a restart anyway.
+     */
+    typedef struct {
+        /** Marks a snapshot.
+         */
+        uint32_t magic;
+
+        /** The layout version.
+         */
+        uint16_t version;
+
+        /** The value of sizeof(Snapshot).
+         */
+        uint16_t size;
+
+        /** PowerSource per instance.
+         */
+        uint8_t powerSourceInstance[MAX_NUM_POWER_SOURCES];
+
+        /** Bit-map of M2MDevice::DeviceResource.
+         */
+        uint32_t presentResources;
+
+        int32_t voltageMV[MAX_NUM_POWER_SOURCES];
+        int32_t currentMA[MAX_NUM_POWER_SOURCES];
+        int32_t batteryLevelPercent;
+        int32_t batteryStatus;
+        int32_t errorCode;
+        int64_t memoryTotalKBytes;
+        int64_t memoryFreeKBytes;
+        char string[NUM_SNAPSHOT_STRINGS][CLOUD_CLIENT_SNAPSHOT_STRING_SIZE];
+
+        /** CRC32 of all of the above.
+         */
+        uint32_t crc;
+    } Snapshot;
+
     /** Constructor.
      *
      * @param debugOn                  true if you want debug prints, otherwise false.
+     *                                 Unless CLOUD_CLIENT_DM_LOG_DEFERRED is set to 0,
+     *                                 debug prints are recorded in a RAM ring buffer
+     *                                 and printed later by a low-priority thread
+     *                                 (see cloud_client_dm_log.h).
      * @param registeredUserCallback   function to be called when registration with a
      *                                 LWM2M server has completed.
      * @param deregisteredUserCallback function to be called when the client has
@@ -141,14 +902,33 @@ public:
      *                             been included, this merely offers an
      *                             error trap should you forget (otherwise
      *                             the mbed cloud client code will assert).
+     *                             It is not called for writes covered by
+     *                             a handler set with setWriteHandler().
      * @return                     true if successful, otherwise false.
      */
     bool start(MbedCloudClientCallback *globalUpdateCallback = NULL);
 
     /** Stop the mbed cloud client and its objects, deregistering from the
      * server if required.
+     *
+     * If drainTimeoutMs is non-zero and the client is registered, any
+     * updates still held back (in queue mode, by the power policy or
+     * in resource handles) are sent first and deregistration waits
+     * until the server has acknowledged the notifications of the
+     * Device object resources that changed, or until drainTimeoutMs
+     * has passed, whichever is sooner, so that e.g. a final battery
+     * level or ERROR_LOW_BATTERY is not lost.  Without
+     * CLOUD_CLIENT_DM_DELIVERY_STATUS there is no way to tell when
+     * the notifications have been acknowledged and so, if any were
+     * sent, a fixed settling time is waited instead: the lesser of
+     * drainTimeoutMs and CLOUD_CLIENT_DRAIN_SETTLE_MS.  The outcome
+     * is recorded in the statistics (see getStats()).
+     *
+     * @param drainTimeoutMs the maximum time to wait for outstanding
+     *                       notifications to be acknowledged before
+     *                       deregistering, 0 to deregister at once.
      */
-    void stop();
+    void stop(int drainTimeoutMs = 0);
 
     /** Connect the mbed cloud client with the server.
      *
@@ -157,6 +937,86 @@ public:
      */
     bool connect(void *interface);
 
+    /** Bring up a network interface in the background, so that the
+     * (potentially lengthy) network attach overlaps with configuring
+     * CloudClientDm, its objects and start().  Call this as early as
+     * possible, before or instead of bringing up the interface
+     * yourself, then configure and start() as usual but do not call
+     * connect(): it is called with this interface as soon as both the
+     * attach has succeeded and start() has been called, whichever
+     * finishes last.  An interface that is already connected counts
+     * as attached.  If the attach fails, EVENT_ERROR is published
+     * with the nsapi_error_t; if the connect() that follows fails,
+     * EVENT_ERROR is published with MbedCloudClient::ConnectUnknownError
+     * (see subscribe()).  Both the attach time and the time from
+     * construction of CloudClientDm to registration are recorded in
+     * the statistics.
+     *
+     * @param interface  a pointer to the NetworkInterface to use.
+     * @return           true if the attach has been started, otherwise false.
+     */
+    bool attachNetwork(NetworkInterface *interface);
+
+    /** Connect the mbed cloud client with the server over the first
+     * of a list of network interfaces that works, e.g. LTE-M, then
+     * NB-IoT, then Wi-Fi.  Each interface is brought up and given
+     * timeoutSeconds to complete registration; if it fails the Mbed
+     * Cloud Client is closed (waiting, as stop() does, for that to
+     * complete), the interface brought down, unless it was already up
+     * when this function was called, and the next interface tried.
+     * This function blocks until registration has completed or all
+     * of the interfaces have failed.  At most
+     * CLOUD_CLIENT_MAX_NUM_INTERFACES interfaces are tried; any more
+     * than that are ignored, with a warning.
+     *
+     * The time to registration over each interface is remembered
+     * and, on
+     * the next call, interfaces that have registered are tried first,
+     * fastest first, followed by those not yet tried, in the order
+     * given, and lastly those that have failed.
+     *
+     * @param interfaces     the interfaces, in order of preference.
+     * @param numInterfaces  the number of interfaces.
+     * @param timeoutSeconds how long to wait for each interface.
+     * @return               true if registered, otherwise false.
+     */
+    bool connect(NetworkInterface * const *interfaces, int numInterfaces,
+                 int timeoutSeconds = CLOUD_CLIENT_CONNECT_TIMEOUT_SECONDS);
+
+    /** Get the interface that connect() with a list of interfaces
+     * registered over.
+     *
+     * @return the interface, NULL if there is none.
+     */
+    NetworkInterface *getConnectedInterface();
+
+    /** Get the estimated quality of the link to the server, with the
+     * CoAP block size and retransmission parameters recommended for
+     * it: large blocks and short time-outs on a good link, to save
+     * round trips, small blocks and patient time-outs on a lossy one,
+     * to save retransmissions.  The estimate is a moving average of
+     * exchanges with the server succeeding (registration, registration
+     * update) or failing (time-out, network or secure connection
+     * errors).  Throughput is measured over keepAlive() calls at least
+     * CLOUD_CLIENT_LINK_QUALITY_WINDOW_SECONDS apart, while connectivity
+     * statistics are being counted (see countConnectivityTx()).
+     *
+     * The block size and retransmission parameters of the Mbed Cloud
+     * Client are fixed when it is built, hence these are offered as
+     * recommendations for those platforms and payloads where they can
+     * be applied, e.g. through setLinkQualityCallback().
+     *
+     * @param linkQuality a place to put the link quality.
+     */
+    void getLinkQuality(LinkQuality *linkQuality);
+
+    /** Set a callback to be called when the recommended CoAP transfer
+     * parameters change.
+     *
+     * @param linkQualityCallback the callback, NULL for none.
+     */
+    void setLinkQualityCallback(Callback<void(const LinkQuality *)> linkQualityCallback);
+
     /** Returns true if the client is connected to the server.
      *
      * @return  true if the client is connected to the server,
@@ -164,10 +1024,42 @@ public:
      */
     bool isConnected();
 
-    /** Keep a UDP link cooking.
+    /** Keep a UDP link cooking.  This is also where values that
+     * CloudClientDm maintains itself are refreshed: the resources of
+     * the Connectivity Statistics object (see
+     * addConnectivityStatisticsObject()), the history resource (see
+     * enableDeviceObjectHistory()), power source values and updates
+     * held back (see setPowerPolicy() and setUpdatePriority()) and
+     * custom resources set through a handle (see flushResources()).
+     * A server read between calls sees those values as they were at
+     * the last call, so an application that does not otherwise need
+     * keep-alives (e.g. over TCP) should still call this periodically
+     * if it uses any of them.
      */
     void keepAlive();
 
+    /** Get the statistics on the operation of CloudClientDm.
+     *
+     * @param stats a pointer to a place to put the statistics.
+     */
+    void getStats(Stats *stats);
+
+    /** Reset the statistics, taking the heap currently in use
+     * as the baseline against which growth is measured.
+     */
+    void resetStats();
+
+    /** Get the heap attributed to a part of CloudClientDm; these
+     * figures are cumulative and are not affected by resetStats().
+     * Only available if CLOUD_CLIENT_DM_HEAP_TAGS is 1 and
+     * MBED_HEAP_STATS_ENABLED is defined.
+     *
+     * @param tag   the HeapTag.
+     * @param stats a pointer to a place to put the figures.
+     * @return      true if successful, otherwise false.
+     */
+    bool getHeapTagStats(HeapTag tag, HeapTagStats *stats);
+
     /** Set the value of the Device object Device Type resource.
      * The value of this static resource is stored in Cloud Client
      * storage.
@@ -204,6 +1096,23 @@ public:
      */
     bool setDeviceObjectSoftwareVersion(const char *softwareVersion);
 
+#if CLOUD_CLIENT_DM_READ_CALLBACKS
+    /** Set the value of the Device object Device Type, Serial Number,
+     * Hardware Version or Software Version resource by reference:
+     * the resource holds no copy of the string, which is served to
+     * the server directly from the storage given, typically a string
+     * literal in flash, by a read callback.  The value is NOT stored
+     * in Cloud Client storage.  This must be called before start().
+     *
+     * @param resource the resource.
+     * @param value    the value, which must remain valid for the
+     *                 lifetime of CloudClientDm.
+     * @return         true if successful, otherwise false.
+     */
+    bool setDeviceObjectConstString(M2MDevice::DeviceResource resource,
+                                    const char *value);
+#endif
+
     /** Set the value of the Device object Firmware Version resource.
      * You'da though that the value of this resource would be stored
      * statically in Cloud Client storage but for some reason the
@@ -322,59 +1231,863 @@ public:
      */
     bool setDeviceObjectTimezone(const char *timezoneIANA);
 
-protected:
-
-    /** Callback for registration event.
+    /** Add the Connectivity Monitoring object (urn:oma:lwm2m:oma:4)
+     * to the client.  This must be called before start().  The
+     * mandatory resources are created with default values, set them
+     * with the setConnectivityMonitoringXxx() methods.
+     *
+     * @return true if successful, otherwise false.
      */
-    void clientRegisteredCallback();
+    bool addConnectivityMonitoringObject();
 
-    /** Callback for deregistration event.
+    /** Set the Network Bearer resource of the Connectivity Monitoring
+     * object; the Available Network Bearer resource is set to match.
+     *
+     * @param bearer the network bearer in use.
+     * @return       true if successful, otherwise false.
      */
-    void clientDeregisteredCallback();
+    bool setConnectivityMonitoringBearer(NetworkBearer bearer);
 
-    /** Callback for error event.
+    /** Set the Radio Signal Strength and Link Quality resources
+     * of the Connectivity Monitoring object.
      *
-     * @param errorCode the Mbed Client error code.
+     * @param signalStrengthDbm the average received signal strength,
+     *                          e.g. RSRP for LTE, in dBm.
+     * @param linkQuality       the link quality, e.g. RSRQ for LTE.
+     * @return                  true if successful, otherwise false.
      */
-    void errorCallback(int errorCode);
+    bool setConnectivityMonitoringRadio(int signalStrengthDbm, int linkQuality);
 
-    /** Create the given string resource on the Device object.
-     * The resources on which this can be used are:
+    /** Set the cell resources of the Connectivity Monitoring object.
      *
-     * M2MDevice::Manufacturer
-     * M2MDevice::DeviceType
-     * M2MDevice::ModelNumber
-     * M2MDevice::SerialNumber
-     * M2MDevice::HardwareVersion
-     * M2MDevice::FirmwareVersion
-     * M2MDevice::SoftwareVersion
-     * M2MDevice::UTCOffset
-     * M2MDevice::Timezone
-     * M2MDevice::SupportedBindingMode
+     * @param cellId the serving cell ID.
+     * @param mnc    the serving Mobile Network Code.
+     * @param mcc    the serving Mobile Country Code.
+     * @return       true if successful, otherwise false.
+     */
+    bool setConnectivityMonitoringCell(int cellId, int mnc, int mcc);
+
+    /** Set the IP Addresses resource of the Connectivity Monitoring
+     * object.
      *
-     * @param resource  the type of the resource.
-     * @param value     the string value to set.
+     * @param ipAddress the IP address as a string.
      * @return          true if successful, otherwise false.
      */
-    bool createDeviceObjectResource(M2MDevice::DeviceResource resource,
-                                    const char *value);
+    bool setConnectivityMonitoringIpAddress(const char *ipAddress);
 
-    /** Create the given single-instance integer resource on
-     * the Device object.  The resources on which this can be
-     * used are:
+    /** Set the APN resource of the Connectivity Monitoring object.
      *
-     * M2MDevice::BatteryLevel
-     * M2MDevice::BatteryStatus
-     * M2MDevice::MemoryFree
-     * M2MDevice::MemoryTotal
-     * M2MDevice::CurrentTime
+     * @param apn the APN as a string.
+     * @return    true if successful, otherwise false.
+     */
+    bool setConnectivityMonitoringApn(const char *apn);
+
+    /** Add the Connectivity Statistics object (urn:oma:lwm2m:oma:7)
+     * to the client.  This must be called before start().  Collection
+     * of statistics is started and stopped by the server through the
+     * Start and Stop resources of the object, or locally with
+     * startConnectivityStatistics()/stopConnectivityStatistics().
+     * The counters are not copied into the resources on every packet
+     * or on a read but by keepAlive() (and by stopping collection),
+     * hence a read by the server returns the values as of the last
+     * keepAlive().
      *
-     * @param resource  the type of the resource.
-     * @param value     the integer to set.
-     * @return          true if successful, otherwise false.
+     * @return true if successful, otherwise false.
      */
-    bool createDeviceObjectResource(M2MDevice::DeviceResource resource,
-                                    int64_t value);
+    bool addConnectivityStatisticsObject();
+
+    /** Start collecting connectivity statistics, resetting
+     * the counters.
+     */
+    void startConnectivityStatistics();
+
+    /** Stop collecting connectivity statistics; the values
+     * collected so far remain readable.
+     */
+    void stopConnectivityStatistics();
+
+    /** Count an IP packet sent.  Call this from the send path of
+     * the network driver; when statistics collection is stopped
+     * this costs only a flag test.
+     *
+     * @param bytes the number of bytes sent.
+     */
+    void countConnectivityTx(uint32_t bytes);
+
+    /** Count an IP packet received.  Call this from the receive
+     * path of the network driver; when statistics collection is
+     * stopped this costs only a flag test.
+     *
+     * @param bytes the number of bytes received.
+     */
+    void countConnectivityRx(uint32_t bytes);
+
+    /** Switch radio energy accounting on or off (it is off by
+     * default).  The packets counted by countConnectivityTx() and
+     * countConnectivityRx() (which must be called, though
+     * connectivity statistics need not be running) are attributed
+     * to the operation that most likely caused them: the one in
+     * progress or started in the last CLOUD_CLIENT_RADIO_ATTRIBUTION_MS.
+     * The radio-active time and energy of each operation are then
+     * estimated from the given costs.  The figures are cleared by
+     * resetStats().
+     *
+     * @param on    true to account for radio usage, else false.
+     * @param costs the radio costs, NULL for a built-in set
+     *              typical of an LTE-M modem; the contents are
+     *              copied.
+     */
+    void setRadioAccounting(bool on, const RadioCosts *costs = NULL);
+
+    /** Get the radio usage attributed to an operation.
+     *
+     * @param operation the RadioOperation.
+     * @param stats     a pointer to a place to put the figures.
+     * @return          true if successful, otherwise false.
+     */
+    bool getRadioStats(RadioOperation operation, RadioStats *stats);
+
+    /** Set the policy for authorizing firmware update downloads and
+     * installs.  Without a policy every step of an update proceeds
+     * as soon as the server requests it; with one, a step that is
+     * not allowed is deferred and re-evaluated whenever the battery
+     * level or idle state changes, or keepAlive() is called.  Only
+     * has an effect if MBED_CLOUD_CLIENT_SUPPORT_UPDATE is defined.
+     *
+     * @param minBatteryLevelPercent if an internal battery power source
+     *                               exists, defer while its Battery Level
+     *                               is below this; -1 for no limit.
+     * @param requireIdle            if true, defer until the application
+     *                               declares itself idle with setUpdateIdle().
+     * @param policyCallback         optional callback for an application
+     *                               policy, called with
+     *                               MbedCloudClient::UpdateRequestDownload
+     *                               or MbedCloudClient::UpdateRequestInstall;
+     *                               return true to allow the step now.
+     */
+    void setUpdatePolicy(int minBatteryLevelPercent, bool requireIdle,
+                         Callback<bool(int32_t)> policyCallback = NULL);
+
+    /** Declare whether the application is in an idle window, in which
+     * a firmware update step may proceed (see setUpdatePolicy()).
+     *
+     * @param idle true if the application is idle, otherwise false.
+     */
+    void setUpdateIdle(bool idle);
+
+    /** Set a callback to be called with the progress of a firmware
+     * update download.  The callback is only called when the progress
+     * moves on by at least one percent.
+     *
+     * @param progressCallback the callback, taking the percentage
+     *                         downloaded.
+     */
+    void setUpdateProgressCallback(Callback<void(int)> progressCallback);
+
+    /** Set the minimum free heap below which a firmware update
+     * download is deferred, to avoid it failing part-way through
+     * with MbedCloudClient::UpdateErrorWriteToStorage.  Only has an
+     * effect if MBED_HEAP_STATS_ENABLED is defined.
+     *
+     * @param minHeapFreeBytes the minimum free heap, -1 for no limit.
+     */
+    void setUpdateMinHeapFree(int minHeapFreeBytes);
+
+    /** Set the free heap watermarks at which optional features are
+     * shed, so that registration survives when memory runs low rather
+     * than failing with an obscure error.  keepAlive() checks the
+     * free heap: below lowFreeBytes it sheds one more feature each
+     * time, in the order of MemoryShedLevel, which puts first what
+     * frees heap at the least cost, below criticalFreeBytes
+     * it sheds them all at once and, once free heap is back above
+     * lowFreeBytes plus CLOUD_CLIENT_MEMORY_HYSTERESIS_BYTES, it
+     * restores one feature each time.  Each step is logged and sets
+     * the Device object Error Code to ERROR_OUT_OF_MEMORY, which is
+     * cleared when everything has been restored.  Only has an effect
+     * if MBED_HEAP_STATS_ENABLED is defined.
+     *
+     * @param lowFreeBytes      the low watermark, -1 to switch the
+     *                          memory pressure controller off (which
+     *                          restores anything that was shed).
+     * @param criticalFreeBytes the critical watermark, -1 for none.
+     */
+    void setMemoryWatermarks(int lowFreeBytes, int criticalFreeBytes = -1);
+
+    /** Get how much has been shed under memory pressure.
+     *
+     * @return the memory shed level.
+     */
+    MemoryShedLevel getMemoryShedLevel();
+
+    /** Switch queue mode on or off.  In queue mode, the Device object
+     * resources that change while the client is not registered with the
+     * server, or is asleep with LWM2M queue-mode binding, are recorded.
+     * As soon as the client registers again a notification of each is
+     * sent, in one burst, most important first (Error Code, then
+     * Battery Status and Battery Level, then the power sources, etc.).
+     *
+     * If the mbed Cloud Client is built with
+     * MBED_CLOUD_CLIENT_TRANSPORT_MODE_UDP_QUEUE, a sleepy device calls
+     * keepAlive() to wake, the queue is flushed as soon as the
+     * registration update completes and sleepCallback is called when the
+     * client goes back to sleep, at which point the radio may be
+     * switched off.
+     *
+     * @param on            true to switch queue mode on, otherwise false.
+     * @param sleepCallback optional callback for when the client goes
+     *                      to sleep in queue-mode binding.
+     */
+    void setQueueMode(bool on, Callback<void()> sleepCallback = NULL);
+
+    /** Send a notification of each Device object resource that has
+     * been recorded in queue mode; this is done automatically on
+     * registration.
+     *
+     * @return the number of resources flushed.
+     */
+    int flushQueue();
+
+    /** Set the priority class of a Device object resource.  A
+     * critical update bypasses the rate limit and deadband of the
+     * power policy (see setPowerPolicy()) and goes ahead of the rest
+     * when queued updates are flushed; a normal update goes as soon
+     * as it is set; a bulk update (integer resources only) is held
+     * back and written by the next keepAlive(), at most
+     * CLOUD_CLIENT_MAX_UPDATES_PER_FLUSH at a time, oldest first, or
+     * by flushUpdates().  Note that an application that does not call
+     * keepAlive() (e.g. over TCP) must call flushUpdates() itself for
+     * bulk updates to be sent.  By default Error Code and Battery
+     * Status are critical and everything else is normal: bulk is
+     * opt-in.  The queueing delay of each class is recorded in the
+     * statistics (see getStats()).
+     *
+     * @param resource the type of the resource.
+     * @param priority the priority class.
+     * @return         true if successful, otherwise false.
+     */
+    bool setUpdatePriority(M2MDevice::DeviceResource resource,
+                           UpdatePriority priority);
+
+    /** Get the priority class of a Device object resource.
+     *
+     * @param resource the type of the resource.
+     * @return         the priority class.
+     */
+    UpdatePriority getUpdatePriority(M2MDevice::DeviceResource resource);
+
+    /** Write the updates held back by their priority class, oldest
+     * first; keepAlive() does this CLOUD_CLIENT_MAX_UPDATES_PER_FLUSH
+     * at a time.
+     *
+     * @param maxNumUpdates the most updates to write, -1 for all.
+     * @return              the number of updates written.
+     */
+    int flushUpdates(int maxNumUpdates = -1);
+
+    /** Keep a compressed history of the Voltage, Current and (for the
+     * internal battery) Battery Level values set for each power source,
+     * so that short events between server reads are not lost.  This
+     * must be called before start().
+     *
+     * The history is exposed, without notifications, as the opaque
+     * resource 0 of instance 0 of a companion object named
+     * CLOUD_CLIENT_HISTORY_OBJECT_NAME, which the server can fetch in
+     * one (block-wise) read.  The resource is not built on a read but
+     * refreshed by keepAlive(), hence a read returns the history as of
+     * the last keepAlive().
+     * It is a sequence of chunks, oldest first, each consisting of:
+     *
+     * - power source instance ID: 1 byte,
+     * - power source (a PowerSource value): 1 byte,
+     * - length of the samples that follow: 2 bytes, little endian,
+     * - time of the first sample in milliseconds since history was
+     *   enabled: 4 bytes, little endian,
+     * - the samples, each of which is a varint of
+     *   (milliseconds since the previous sample << 2 | kind), where kind
+     *   is 0 for voltage, 1 for current and 2 for battery level, followed
+     *   by a zigzag varint of the difference from the previous value of
+     *   the same kind in the chunk (the first being relative to zero).
+     *
+     * Each power source has two chunks of CLOUD_CLIENT_HISTORY_CHUNK_SIZE
+     * bytes in RAM, used alternately.  When spillToStorage is true, a
+     * chunk about to be overwritten is first written to Cloud Client
+     * storage and included, as the oldest chunk, in the history.
+     *
+     * @param spillToStorage true to keep one more chunk of history
+     *                       per power source in Cloud Client storage.
+     * @return               true if successful, otherwise false.
+     */
+    bool enableDeviceObjectHistory(bool spillToStorage = false);
+
+    /** Create a custom object, with instance 0, owned by CloudClientDm.
+     * This must be called before start().
+     *
+     * @param name the name of the object, e.g. "3303".
+     * @return     the object instance, to which resources can be added
+     *             with addCustomResource(), NULL on failure.
+     */
+    M2MObjectInstance *addCustomObject(const char *name);
+
+    /** Add a resource to a custom object instance, returning a typed
+     * handle through which the resource is later set without any
+     * lookup, e.g.:
+     *
+     * M2MObjectInstance *temperature = cloudClientDm->addCustomObject("3303");
+     * CloudClientDm::ResourceHandle<float> *value =
+     *     cloudClientDm->addCustomResource<float>(temperature, "5700", M2MBase::GET_ALLOWED);
+     * ...
+     * value->set(21.5);
+     *
+     * The handle is owned by CloudClientDm and is valid until it is
+     * deleted.  Values set are written to the resources by keepAlive()
+     * or flushResources().  If operation allows PUT then a write from
+     * the server updates the cached value.  This must be called before
+     * start().
+     *
+     * @param objectInstance the object instance, from addCustomObject().
+     * @param name           the name of the resource, e.g. "5700".
+     * @param operation      the operations allowed.
+     * @return               the handle, NULL on failure.
+     */
+    template <typename T>
+    ResourceHandle<T> *addCustomResource(M2MObjectInstance *objectInstance,
+                                         const char *name,
+                                         M2MBase::Operation operation)
+    {
+        ResourceHandle<T> *handle = NULL;
+        M2MResource *resource = NULL;
+
+        if (!_started) {
+            resource = createResource(objectInstance, name, ResourceTraits<T>::type, operation);
+        }
+        if (resource != NULL) {
+            handle = new ResourceHandle<T>(resource);
+            if ((operation & M2MBase::PUT_ALLOWED) != 0) {
+                resource->set_value_updated_function(value_updated_callback(handle,
+                                                                            &ResourceHandle<T>::valueUpdated));
+            }
+            ResourceTraits<T>::write(resource, handle->get());
+            handle->_next = _resourceHandleList;
+            _resourceHandleList = handle;
+        }
+
+        return handle;
+    }
+
+    /** Write the values set through the custom resource handles to
+     * their resources.  This is also done by keepAlive().
+     *
+     * @return the number of resources written.
+     */
+    int flushResources();
+
+    /** Enable publishing of batches of resources.  This must be called
+     * before start().  It creates a companion object, named
+     * CLOUD_CLIENT_BATCH_OBJECT_NAME, with an observable opaque
+     * resource 0 through which batches are published.
+     *
+     * @return true if successful, otherwise false.
+     */
+    bool enableBatch();
+
+    /** Publish the current values of a set of resources, which may
+     * be in any objects, as a single SenML-CBOR (RFC 8428) payload,
+     * so that they reach the server in one notification rather than
+     * one each.  Each record carries, as its name ("n"), the path of
+     * the resource and its value as "v" (integer/float), "vb" (boolean),
+     * "vs" (string) or "vd" (opaque).  For multi-instance resources,
+     * pass the individual resource instances.  The payload size and
+     * encode time are recorded in the statistics alongside the total
+     * size of the same values as individual payloads.
+     *
+     * @param resources          the resources.
+     * @param numResources       the number of resources.
+     * @param includePowerSources if true, the Voltage and Current of
+     *                           every power source are added to the batch.
+     * @return                   the size of the payload, -1 on failure.
+     */
+    int publishBatch(M2MResourceInstance * const *resources, int numResources,
+                     bool includePowerSources = false);
+
+    /** Scale CloudClientDm's own radio usage with the state of the
+     * power supply.  The table must be ordered from the highest
+     * minBatteryLevelPercent to the lowest; the entry chosen is:
+     *
+     * - the first, whenever a DC, USB, PoE or mains power source is
+     *   present or the internal battery is charging,
+     * - the last, when the battery status is BATTERY_STATUS_LOW_BATTERY,
+     * - otherwise the first whose minBatteryLevelPercent is at or below
+     *   the Battery Level resource.
+     *
+     * The chosen entry then limits how often keepAlive() actually
+     * sends a keep-alive and how often, and by how little, the Voltage
+     * and Current resources of power sources are updated.  Each
+     * Voltage and each Current resource of each power source has its
+     * own minimum report interval; a value held back, whether by that
+     * interval or because the change is inside the deadband, is
+     * written by keepAlive() once the interval has passed, so the
+     * server is never left with a stale value.  The policy is
+     * re-evaluated whenever a power source, the Battery Level or the
+     * Battery Status changes.
+     *
+     * @param table      the policy table, which must remain valid; NULL
+     *                   to use a built-in table.
+     * @param numEntries the number of entries in table, 0 to switch
+     *                   the policy off (the default); may be left
+     *                   out when table is NULL.
+     * @return           true if successful, otherwise false.
+     */
+    bool setPowerPolicy(const PowerPolicy *table = NULL, int numEntries = -1);
+
+    /** Get the power policy table entry currently in force.
+     *
+     * @return a pointer to the entry, NULL if there is no power policy.
+     */
+    const PowerPolicy *getPowerPolicy();
+
+    /** Capture the state of CloudClientDm, i.e. the power sources and
+     * the values of the Device object resources, into a compact,
+     * checksummed structure that may be kept, for instance, in
+     * retained RAM across a watchdog reset or deep sleep.  Strings
+     * longer than CLOUD_CLIENT_SNAPSHOT_STRING_SIZE - 1 are truncated.
+     *
+     * @param snapshot a place to put the snapshot.
+     * @return         true if successful, otherwise false.
+     */
+    bool snapshot(Snapshot *snapshot);
+
+    /** Apply a snapshot, taken by snapshot(), to a newly constructed
+     * CloudClientDm in place of the individual "add" and "set" calls.
+     * This must be called before start(); the snapshot is checked
+     * and nothing is applied if it is not valid.
+     *
+     * @param snapshot the snapshot.
+     * @return         true if successful, otherwise false.
+     */
+    bool restore(const Snapshot *snapshot);
+
+    /** Subscribe to events.  Any number of subscribers, up to
+     * CLOUD_CLIENT_MAX_NUM_SUBSCRIBERS, may be added, in addition to
+     * the callbacks given to the constructor.
+     *
+     * The Mbed Cloud Client raises events in its own thread; to keep
+     * a slow handler from stalling it, give a queue: the event is
+     * then posted to that queue, which costs only an enqueue in the
+     * Mbed Cloud Client's thread, and the callback is called by
+     * whichever thread dispatches the queue.  If the queue is full
+     * the event is dropped for that subscriber and counted in the
+     * statistics.
+     *
+     * @param callback  the callback, which is given the event and a
+     *                  parameter (the error code for EVENT_ERROR,
+     *                  otherwise 0).
+     * @param eventMask the events of interest, a bit-map of Event.
+     * @param queue     the queue to deliver the events on, NULL to
+     *                  call callback directly from the Mbed Cloud
+     *                  Client's thread.
+     * @return          a subscriber ID, to pass to unsubscribe(),
+     *                  -1 on failure.
+     */
+    int subscribe(Callback<void(Event, int)> callback, uint32_t eventMask = EVENT_ALL,
+                  EventQueue *queue = NULL);
+
+    /** Unsubscribe from events.  Note that an event being passed on
+     * in the Mbed Cloud Client's thread at the time may still reach
+     * the callback once after this returns.
+     *
+     * @param subscriberId the ID returned by subscribe().
+     * @return             true if successful, otherwise false.
+     */
+    bool unsubscribe(int subscriberId);
+
+    /** Set a handler for writes by the server to a resource, to all
+     * the resources of an object instance or to all the resources of
+     * an object.  Handlers are kept in a hash table keyed by object,
+     * instance and resource ID but are looked up only when they are
+     * bound: start(), and any call made after start(), gives each
+     * writable resource the most specific handler that covers it as
+     * its value updated function, so a write goes straight to its
+     * handler.  Resources created after that, and resources that
+     * already have a value updated function (e.g. those with a
+     * ResourceHandle), are not covered.  The globalUpdateCallback
+     * given to start() is called for writes that no handler covers.
+     *
+     * @param handler    the handler, which is given the M2MBase that
+     *                   was written; NULL to remove the handler.
+     * @param objectId   the object ID, e.g. 3303.
+     * @param instanceId the object instance ID, -1 for all instances.
+     * @param resourceId the resource ID, -1 for all resources.
+     * @return           true if successful, otherwise false.
+     */
+    bool setWriteHandler(Callback<void(M2MBase *)> handler, uint16_t objectId,
+                         int instanceId = -1, int resourceId = -1);
+
+protected:
+
+    /** The history kept for one power source, in two chunks.
+     */
+    typedef struct {
+        uint32_t startTimeMs;
+        uint32_t lastTimeMs;
+        int32_t lastValue[3];
+        uint16_t length;
+        uint8_t data[CLOUD_CLIENT_HISTORY_CHUNK_SIZE];
+    } HistoryChunk;
+
+    typedef struct {
+        HistoryChunk chunk[2];
+        uint8_t active;
+    } History;
+
+    /** The number of Connectivity Statistics counters.
+     */
+#   define CONNECTIVITY_STATISTICS_NUM_COUNTERS 5
+
+    /** Callback for registration event.
+     */
+    void clientRegisteredCallback();
+
+    /** Callback for deregistration event.
+     */
+    void clientDeregisteredCallback();
+
+    /** Callback for registration updated event.
+     */
+    void clientRegistrationUpdatedCallback();
+
+    /** Callback for the client going to sleep in queue-mode binding.
+     */
+    void queueSleepCallback();
+
+    /** Record that a Device object resource has changed: for queue
+     * mode if not registered, for the drain phase of stop() and, if
+     * the update is going out now, in the statistics of its priority
+     * class.
+     *
+     * @param resource  the type of the resource.
+     * @param delayMs   how long the update was held back.
+     */
+    void queueDeviceObjectResource(M2MDevice::DeviceResource resource,
+                                   int delayMs = 0);
+
+    /** Hold back an integer Device object resource update for the
+     * next flush, replacing any update of the same resource already
+     * held back.
+     *
+     * @param resource the type of the resource.
+     * @param instance the instance ID, -1 for a single-instance resource.
+     * @param value    the value.
+     * @return         true if the update was held back, false if
+     *                 there was no room.
+     */
+    bool deferUpdate(M2MDevice::DeviceResource resource, int instance,
+                     int64_t value);
+
+    /** Record an update sent in the statistics of its priority class.
+     *
+     * @param priority the priority class.
+     * @param delayMs  how long the update was held back.
+     */
+    void recordUpdateSent(UpdatePriority priority, int delayMs);
+
+    /** Check the free heap against the watermarks and shed or
+     * restore features accordingly; called by keepAlive().
+     */
+    void updateMemoryPressure();
+
+    /** Shed or restore features, a step at a time, until the
+     * given memory shed level is reached.
+     *
+     * @param level     the memory shed level wanted.
+     * @param freeBytes the free heap, for logging.
+     */
+    void setMemoryShedLevel(MemoryShedLevel level, int freeBytes);
+
+    /** Send everything that is held back and wait for the
+     * notifications of the changed Device object resources to be
+     * acknowledged, for at most drainTimeoutMs or the settling time
+     * (see stop()); called by stop().
+     *
+     * @param drainTimeoutMs the maximum time to wait.
+     */
+    void drain(int drainTimeoutMs);
+
+#if CLOUD_CLIENT_DM_DELIVERY_STATUS
+    /** Message delivery status callback for the Device object
+     * resources, used to tell when a notification has been
+     * acknowledged.
+     *
+     * @param base     the resource the message was about.
+     * @param status   the delivery status.
+     * @param type     the type of the message.
+     * @param context  a pointer to this CloudClientDm.
+     */
+    static void deliveryStatusCallback(const M2MBase &base,
+                                       M2MBase::MessageDeliveryStatus status,
+                                       M2MBase::MessageType type,
+                                       void *context);
+#endif
+
+    /** Create the Device object resources for a power source instance.
+     *
+     * @param powerSource the power source.
+     * @param instance    the instance ID, which must be free.
+     * @return            true if successful, otherwise false.
+     */
+    bool createPowerSourceInstance(PowerSource powerSource, uint16_t instance);
+
+    /** Record the time taken by a plug event in the statistics.
+     *
+     * @param durationUs the time taken by the add or delete.
+     */
+    void recordPlugEvent(int durationUs);
+
+    /** Pass an event to the subscribers that want it.
+     *
+     * @param event     the event.
+     * @param parameter the parameter for the event.
+     */
+    void publishEvent(Event event, int parameter);
+
+    /** Find the remembered registration latency of an interface.
+     *
+     * @param interface the interface.
+     * @param add       true to claim an entry if there is none.
+     * @return          the index into _interfaceLatency, -1 if
+     *                  there is none.
+     */
+    int findInterfaceLatency(NetworkInterface *interface, bool add);
+
+    /** Feed the link quality estimate with the outcome of an exchange
+     * with the server.
+     *
+     * @param success true if the exchange succeeded, otherwise false.
+     */
+    void updateLinkQuality(bool success);
+
+    /** Measure link throughput, if the measurement window has passed.
+     */
+    void updateLinkThroughput();
+
+    /** Note the start of an operation, for radio energy accounting.
+     *
+     * @param operation the RadioOperation.
+     */
+    void setRadioOperation(RadioOperation operation);
+
+    /** Attribute a packet to the current operation, for radio
+     * energy accounting.
+     *
+     * @param tx    true if the packet was sent, false if received.
+     * @param bytes the number of bytes in the packet.
+     */
+    void countRadio(bool tx, uint32_t bytes);
+
+    /** Work out the key of a write handler.
+     *
+     * @param objectId   the object ID.
+     * @param instanceId the object instance ID, -1 for all instances.
+     * @param resourceId the resource ID, -1 for all resources.
+     * @return           the key.
+     */
+    static uint64_t writeHandlerKey(uint16_t objectId, int instanceId, int resourceId);
+
+    /** Find the entry for a key in the table of write handlers.
+     *
+     * @param key the key.
+     * @param add true to claim a free entry, or the entry of a
+     *            removed handler, if the key is not present.
+     * @return    the index of the entry, -1 if there is none.
+     */
+    int findWriteHandler(uint64_t key, bool add);
+
+    /** Find the most specific write handler for a resource.
+     *
+     * @param objectId   the object ID.
+     * @param instanceId the object instance ID.
+     * @param resourceId the resource ID.
+     * @return           the index of the entry, -1 if there is none.
+     */
+    int findWriteHandler(uint16_t objectId, int instanceId, int resourceId);
+
+    /** Bind the write handlers to the writable resources they
+     * cover (see setWriteHandler()).
+     */
+    void bindWriteHandlers();
+
+    /** The value updated function of a resource covered by a write
+     * handler, which calls the handler or, if it has since been
+     * removed, the globalUpdateCallback given to start().
+     */
+    class WriteBinding {
+    public:
+        WriteBinding(CloudClientDm *cloudClientDm, M2MBase *base) : _cloudClientDm(cloudClientDm),
+                                                                    _base(base), _handler(-1), _next(NULL) {}
+
+        /** Called by the Mbed Cloud Client when the server writes
+         * the resource.
+         */
+        void valueUpdated(const char *name);
+
+    protected:
+        friend class CloudClientDm;
+        CloudClientDm *_cloudClientDm;
+        M2MBase *_base;
+        int _handler;
+        WriteBinding *_next;
+    };
+
+#if CLOUD_CLIENT_DM_READ_CALLBACKS
+    /** Read callback for the resources set by setDeviceObjectConstString().
+     *
+     * @param resource   the resource being read.
+     * @param buffer     the buffer to write the value to.
+     * @param bufferSize on entry the size of buffer, on return the
+     *                   length of the value.
+     * @param context    the CloudClientDm instance.
+     * @return           the CoAP response code.
+     */
+    static coap_response_code_e readConstStringCallback(const M2MResourceBase &resource,
+                                                        uint8_t *buffer,
+                                                        size_t *bufferSize,
+                                                        void *context);
+#endif
+
+    /** Get the instance ID of a power source.
+     *
+     * @param powerSource the power source.
+     * @return            the instance ID, -1 if there is no such power source.
+     */
+    int getPowerSourceInstance(PowerSource powerSource);
+
+    /** Start keeping history for a power source instance, if enabled.
+     *
+     * @param instance the instance ID.
+     */
+    void createHistory(uint16_t instance);
+
+    /** Stop keeping history for a power source instance.
+     *
+     * @param instance the instance ID.
+     */
+    void deleteHistory(uint16_t instance);
+
+    /** Add a sample to the history of a power source instance.
+     *
+     * @param instance the instance ID.
+     * @param kind     0 for voltage, 1 for current, 2 for battery level.
+     * @param value    the value.
+     */
+    void addHistorySample(uint16_t instance, unsigned int kind, int value);
+
+    /** Write a chunk of history for a power source instance to Cloud
+     * Client storage.
+     *
+     * @param instance the instance ID.
+     * @param chunk    the chunk.
+     */
+    void spillHistoryChunk(uint16_t instance, const HistoryChunk *chunk);
+
+    /** Serialise a chunk of history, in the form described for
+     * enableDeviceObjectHistory().
+     *
+     * @param buffer   the buffer to write to, which must have room for
+     *                 CLOUD_CLIENT_HISTORY_CHUNK_SIZE + 8 bytes.
+     * @param instance the instance ID.
+     * @param chunk    the chunk.
+     * @return         the number of bytes written.
+     */
+    int serialiseHistoryChunk(uint8_t *buffer, uint16_t instance,
+                              const HistoryChunk *chunk);
+
+    /** Refresh the history resource if the history has changed.
+     */
+    void updateDeviceObjectHistory();
+
+    /** Encode one resource as a SenML-CBOR record.
+     *
+     * @param buffer   the buffer to encode into, NULL to just
+     *                 work out the length.
+     * @param resource the resource.
+     * @return         the length of the record.
+     */
+    int encodeBatchRecord(uint8_t *buffer, M2MResourceInstance *resource);
+
+    /** The body of the thread that brings up the network interface.
+     */
+    void attachNetworkThread();
+
+    /** Call connect() once the network is attached and we have
+     * been started.
+     */
+    void connectAfterAttach();
+
+    /** Choose the power policy table entry that applies now.
+     */
+    void updatePowerPolicy();
+
+    /** Update a power source Voltage or Current resource, subject
+     * to the power policy.
+     *
+     * @param resource the resource, PowerSourceVoltage or PowerSourceCurrent.
+     * @param value    the value.
+     * @param instance the power source instance ID.
+     * @return         true if successful (including if held back),
+     *                 otherwise false.
+     */
+    bool setPowerSourceResource(M2MDevice::DeviceResource resource,
+                                int value, uint16_t instance);
+
+    /** Write power source values held back by the power policy.
+     *
+     * @param force true to write them regardless of the
+     *              minimum report interval.
+     */
+    void flushPowerSourceResources(bool force);
+
+    /** Callback for error event.
+     *
+     * @param errorCode the Mbed Client error code.
+     */
+    void errorCallback(int errorCode);
+
+    /** Create the given string resource on the Device object.
+     * The resources on which this can be used are:
+     *
+     * M2MDevice::Manufacturer
+     * M2MDevice::DeviceType
+     * M2MDevice::ModelNumber
+     * M2MDevice::SerialNumber
+     * M2MDevice::HardwareVersion
+     * M2MDevice::FirmwareVersion
+     * M2MDevice::SoftwareVersion
+     * M2MDevice::UTCOffset
+     * M2MDevice::Timezone
+     * M2MDevice::SupportedBindingMode
+     *
+     * @param resource  the type of the resource.
+     * @param value     the string value to set.
+     * @return          true if successful, otherwise false.
+     */
+    bool createDeviceObjectResource(M2MDevice::DeviceResource resource,
+                                    const char *value);
+
+    /** Create the given single-instance integer resource on
+     * the Device object.  The resources on which this can be
+     * used are:
+     *
+     * M2MDevice::BatteryLevel
+     * M2MDevice::BatteryStatus
+     * M2MDevice::MemoryFree
+     * M2MDevice::MemoryTotal
+     * M2MDevice::CurrentTime
+     *
+     * @param resource  the type of the resource.
+     * @param value     the integer to set.
+     * @return          true if successful, otherwise false.
+     */
+    bool createDeviceObjectResource(M2MDevice::DeviceResource resource,
+                                    int64_t value);
 
     /** Create the given multi-instance integer resource on
      * the Device object.  The resources on which this can be
@@ -422,16 +2135,18 @@ protected:
     bool deleteDeviceObjectResource(M2MDevice::DeviceResource resource,
                                     uint16_t instance);
 
-    /** Set a Device object resource.
+    /** Set a Device object resource.  The Mbed Cloud Client takes
+     * the value as a std::string, which is passed on as is.
      *
      * @param resource  the type of the resource.
      * @param str       the value to set.
      * @return          true if successful, otherwise false.
      */
     bool setDeviceObjectResource(M2MDevice::DeviceResource resource,
-                                 std::string str);
+                                 const std::string &str);
 
-    /** Set a Device object resource.
+    /** Set a Device object resource; the value is copied into a
+     * std::string, once, for the Mbed Cloud Client (see above).
      *
      * @param resource  the type of the resource.
      * @param value     the value to set.
@@ -478,6 +2193,50 @@ protected:
     bool setDeviceObjectConfigResource(M2MDevice::DeviceResource resource,
                                        const char *value);
 
+    /** Get the heap currently in use.
+     *
+     * @return  the number of bytes of heap in use, -1 if
+     *          MBED_HEAP_STATS_ENABLED is not defined.
+     */
+    int getHeapInUse();
+
+    /** A Device object resource update held back by its
+     * priority class.
+     */
+    typedef struct {
+        int64_t value;
+        int enqueuedMs;
+        int16_t instance;
+        uint8_t resource;
+        bool used;
+    } PendingUpdate;
+
+    /** The heap in use at the start of a tagged code path.
+     */
+    typedef struct {
+        int bytes;
+        int blocks;
+        int attributedBytes;
+        int attributedBlocks;
+    } HeapMark;
+
+    /** Mark the start of a code path whose heap usage is to be
+     * attributed to a HeapTag; does nothing unless
+     * CLOUD_CLIENT_DM_HEAP_TAGS is 1.
+     *
+     * @param mark a place to put the starting point.
+     */
+    void heapTagBegin(HeapMark *mark);
+
+    /** Mark the end of a tagged code path, attributing the change in
+     * heap usage since heapTagBegin() to the tag, less anything that
+     * nested tagged code paths have already claimed.
+     *
+     * @param tag  the HeapTag.
+     * @param mark the starting point from heapTagBegin().
+     */
+    void heapTagEnd(HeapTag tag, const HeapMark *mark);
+
     /** Get the error string for an MbedClient error code
      *
      * @param errorCode  the Mbed Client error code.
@@ -492,6 +2251,108 @@ protected:
      */
     const char *getCCSErrorString(ccs_status_e errorCode);
 
+    /** Create an object, with instance 0, that is owned (and
+     * deleted) by CloudClientDm, and add it to the client.
+     *
+     * @param name the name of the object, e.g. "4".
+     * @return     a pointer to instance 0 of the object, NULL
+     *             on failure.
+     */
+    M2MObjectInstance *createObject(const char *name);
+
+    /** Create a resource on an object instance.
+     *
+     * @param objectInstance the object instance.
+     * @param name           the name of the resource, e.g. "0".
+     * @param type           the type of the resource.
+     * @param operation      the operations allowed on the resource.
+     * @return               a pointer to the resource, NULL on failure.
+     */
+    M2MResource *createResource(M2MObjectInstance *objectInstance,
+                                const char *name,
+                                M2MResourceInstance::ResourceType type,
+                                M2MBase::Operation operation);
+
+    /** Create instance 0 of a multi-instance resource on an
+     * object instance.
+     *
+     * @param objectInstance the object instance.
+     * @param name           the name of the resource, e.g. "1".
+     * @param type           the type of the resource.
+     * @return               a pointer to the resource instance, NULL
+     *                       on failure.
+     */
+    M2MResourceInstance *createResourceInstance(M2MObjectInstance *objectInstance,
+                                                const char *name,
+                                                M2MResourceInstance::ResourceType type);
+
+    /** Callback for the Start resource of the Connectivity
+     * Statistics object.
+     *
+     * @param argument unused.
+     */
+    void connectivityStatisticsStartCallback(void *argument);
+
+    /** Callback for the Stop resource of the Connectivity
+     * Statistics object.
+     *
+     * @param argument unused.
+     */
+    void connectivityStatisticsStopCallback(void *argument);
+
+    /** Callback for a write to the Collection Period resource of
+     * the Connectivity Statistics object.
+     *
+     * @param name the name of the resource.
+     */
+    void connectivityStatisticsPeriodCallback(const char *name);
+
+    /** Copy the connectivity statistics counters into the resources
+     * of the Connectivity Statistics object.  This is done lazily,
+     * from keepAlive(), rather than on every packet.
+     */
+    void updateConnectivityStatistics();
+
+    /** Handler for a firmware update authorization request, passed
+     * to the mbed Cloud Client.
+     *
+     * @param request the request.
+     */
+    static void updateAuthorizeHandler(int32_t request);
+
+    /** Handler for firmware update download progress, passed
+     * to the mbed Cloud Client.
+     *
+     * @param progress the number of bytes downloaded.
+     * @param total    the total number of bytes to download.
+     */
+    static void updateProgressHandler(uint32_t progress, uint32_t total);
+
+    /** Act on firmware update download progress.
+     *
+     * @param progress the number of bytes downloaded.
+     * @param total    the total number of bytes to download.
+     */
+    void updateProgress(uint32_t progress, uint32_t total);
+
+    /** Check whether a firmware update step is allowed by the
+     * update policy.
+     *
+     * @param request the request.
+     * @return        true if the step is allowed now, otherwise false.
+     */
+    bool updateAllowed(int32_t request);
+
+    /** Authorize the pending firmware update step, if there
+     * is one, when the update policy allows it.
+     */
+    void checkUpdatePending();
+
+    /** The instance that the static firmware update handlers
+     * pass on to; there can only be one.
+     */
+    static CloudClientDm *_updateInstance;
+
     /** Callback to be called when registration has occurred.
      */
     Callback<void()> _registeredUserCallback;
@@ -518,6 +2379,18 @@ protected:
      */
     volatile bool      _registered;
 
+    /** True if connect() has been called and
+     * registration has not yet occurred.
+     */
+    bool               _awaitingRegistration;
+
+    /** The Device object, obtained once, at construction, rather
+     * than from M2MInterfaceFactory on every operation.  This is
+     * still the process-wide M2MDevice singleton, shared by all
+     * instances of CloudClientDm.
+     */
+    M2MDevice         *_deviceObject;
+
     /** The list of LWM2M objects.
      */
     M2MObjectList      _objectList;
@@ -529,6 +2402,401 @@ protected:
     /** Array to track instances of Available Power Source.
      */
     uint16_t           _powerSourceInstance[MAX_NUM_POWER_SOURCES];
+
+    /** The statistics.
+     */
+    Stats              _stats;
+
+    /** The heap attributed to each HeapTag.
+     */
+    HeapTagStats       _heapTag[MAX_NUM_HEAP_TAGS];
+
+    /** The running totals of heap bytes and blocks attributed
+     * to any tag, so that nested code paths are not counted twice.
+     */
+    int                _heapTagAttributedBytes;
+    int                _heapTagAttributedBlocks;
+
+    /** Timer over the period of the statistics.
+     */
+    Timer              _statsTimer;
+
+    /** Timer from connect() to registration.
+     */
+    Timer              _registrationTimer;
+
+    /** The objects created by CloudClientDm itself, deleted
+     * when we are deleted.
+     */
+    M2MObjectList      _ownObjectList;
+
+    /** The Connectivity Monitoring resources that are set at run-time.
+     */
+    M2MResource         *_connMonNetworkBearer;
+    M2MResourceInstance *_connMonAvailableBearer;
+    M2MResource         *_connMonSignalStrength;
+    M2MResource         *_connMonLinkQuality;
+    M2MResourceInstance *_connMonIpAddress;
+    M2MResourceInstance *_connMonApn;
+    M2MResource         *_connMonCellId;
+    M2MResource         *_connMonMnc;
+    M2MResource         *_connMonMcc;
+
+    /** The Connectivity Statistics resources that are set at run-time.
+     */
+    M2MResource         *_connStatsTxData;
+    M2MResource         *_connStatsRxData;
+    M2MResource         *_connStatsMaxMessageSize;
+    M2MResource         *_connStatsAverageMessageSize;
+    M2MResource         *_connStatsCollectionPeriod;
+
+    /** True while connectivity statistics are being collected.
+     */
+    volatile bool      _connStatsRunning;
+
+    /** The connectivity statistics counters: Tx bytes, Rx bytes,
+     * Tx packets, Rx packets, maximum packet size.
+     */
+    volatile uint32_t  _connStats[CONNECTIVITY_STATISTICS_NUM_COUNTERS];
+
+    /** Timer over the connectivity statistics collection period.
+     */
+    Timer              _connStatsTimer;
+
+    /** The firmware update policy.
+     */
+    int                _updateMinBatteryLevelPercent;
+    bool               _updateRequireIdle;
+    Callback<bool(int32_t)> _updatePolicyCallback;
+
+    /** True if the application is idle.
+     */
+    bool               _updateIdle;
+
+    /** True if a firmware update request is waiting for
+     * the update policy to allow it.
+     */
+    volatile bool      _updatePending;
+
+    /** The waiting firmware update request; read and written
+     * together with _updatePending in a critical section.
+     */
+    int32_t            _updateRequest;
+
+    /** The last firmware update download percentage reported.
+     */
+    int                _updateProgressPercent;
+
+    /** The minimum free heap for a firmware update download.
+     */
+    int                _updateMinHeapFreeBytes;
+
+    /** True if in queue mode.
+     */
+    bool               _queueMode;
+
+    /** True if the client is asleep in queue-mode binding.
+     */
+    volatile bool      _queueSleeping;
+
+    /** Bitmap of the Device object resources, by
+     * M2MDevice::DeviceResource, recorded in queue mode.
+     */
+    volatile uint32_t  _queuedResources;
+
+    /** When _queuedResources last went from empty to not empty,
+     * against _bootTimer.
+     */
+    int                _queuedSinceMs;
+
+    /** The priority class of each Device object resource,
+     * by M2MDevice::DeviceResource.
+     */
+    uint8_t            _updatePriority[CLOUD_CLIENT_MAX_NUM_DEVICE_RESOURCES];
+
+    /** The memory watermarks (see setMemoryWatermarks()),
+     * -1 for none.
+     */
+    int                _memoryLowFreeBytes;
+    int                _memoryCriticalFreeBytes;
+
+    /** How much has been shed under memory pressure.
+     */
+    MemoryShedLevel    _memoryShedLevel;
+
+    /** The updates held back by their priority class.
+     */
+    PendingUpdate      _pendingUpdate[CLOUD_CLIENT_MAX_NUM_PENDING_UPDATES];
+
+    /** Bitmap of the Device object resources, by
+     * M2MDevice::DeviceResource, that have changed since their
+     * last notification was acknowledged.
+     */
+    volatile uint32_t  _unackedResources;
+
+    /** Callback to be called when the client goes to sleep
+     * in queue-mode binding.
+     */
+    Callback<void()>   _queueSleepUserCallback;
+
+    /** The history of each power source instance, NULL if
+     * history is not being kept.
+     */
+    History           *_history[MAX_NUM_POWER_SOURCES];
+
+    /** True if history is enabled.
+     */
+    bool               _historyEnabled;
+
+    /** True if history chunks are spilled to storage.
+     */
+    bool               _historySpill;
+
+    /** True if the history has changed since the history
+     * resource was last refreshed.
+     */
+    bool               _historyChanged;
+
+    /** The history resource.
+     */
+    M2MResource       *_historyResource;
+
+    /** Timer that timestamps history.
+     */
+    Timer              _historyTimer;
+
+    /** The custom resource handles, linked through their _next.
+     */
+    ResourceHandleBase *_resourceHandleList;
+
+    /** The event subscribers; an eventMask of zero marks
+     * a free entry.  Entries are only read or written in a
+     * critical section.
+     */
+    struct {
+        Callback<void(Event, int)> callback;
+        uint32_t eventMask;
+        EventQueue *queue;
+    } _subscriber[CLOUD_CLIENT_MAX_NUM_SUBSCRIBERS];
+
+    /** The table of write handlers, open addressed; an entry
+     * with used false is free, one with used true but no handler
+     * is that of a removed handler and may be taken over.
+     */
+    struct {
+        uint64_t key;
+        Callback<void(M2MBase *)> handler;
+        bool used;
+    } _writeHandler[CLOUD_CLIENT_WRITE_HANDLER_TABLE_SIZE];
+
+    /** The resources to which write handlers are bound.
+     */
+    WriteBinding      *_writeBindingList;
+
+    /** The globalUpdateCallback given to start().
+     */
+    MbedCloudClientCallback *_globalUpdateCallback;
+
+    /** The remembered registration latency of each interface
+     * used by connect() with a list of interfaces; latencyMs is
+     * -1 if registration over the interface failed.
+     */
+    struct {
+        NetworkInterface *interface;
+        int latencyMs;
+    } _interfaceLatency[CLOUD_CLIENT_MAX_NUM_INTERFACES];
+
+    /** The interface registered over by connect() with
+     * a list of interfaces.
+     */
+    NetworkInterface  *_connectedInterface;
+
+    /** Set when an error occurs while awaiting registration.
+     */
+    volatile bool      _registrationFailed;
+
+    /** Set by clientDeregisteredCallback(), so that a failed
+     * connect() can wait for the Mbed Cloud Client to close.
+     */
+    volatile bool      _closed;
+
+    /** The link quality and recommendations.
+     */
+    LinkQuality        _linkQuality;
+
+    /** Timer over the link throughput measurement window.
+     */
+    Timer              _linkQualityTimer;
+
+    /** The connectivity statistics byte count at the start
+     * of the link throughput measurement window.
+     */
+    uint32_t           _linkQualityStartBytes;
+
+    /** Callback for changes in the recommended CoAP parameters.
+     */
+    Callback<void(const LinkQuality *)> _linkQualityUserCallback;
+
+    /** Whether radio energy accounting is on (see setRadioAccounting()).
+     */
+    bool               _radioAccounting;
+
+    /** The radio costs.
+     */
+    RadioCosts         _radioCosts;
+
+    /** The radio usage attributed to each RadioOperation.
+     */
+    RadioStats         _radioStats[MAX_NUM_RADIO_OPS];
+
+    /** The operation most recently started and when, against
+     * _bootTimer.
+     */
+    RadioOperation     _radioOperation;
+    int                _radioOperationMs;
+
+    /** When the last packet was counted, against _bootTimer,
+     * -1 if none yet.
+     */
+    int                _radioLastPacketMs;
+
+#if CLOUD_CLIENT_DM_READ_CALLBACKS
+    /** The resources set by setDeviceObjectConstString()
+     * and the strings they serve.
+     */
+    struct {
+        M2MResource *resource;
+        const char *value;
+    } _constString[CLOUD_CLIENT_MAX_NUM_CONST_STRINGS];
+#endif
+
+    /** The resource through which batches are published.
+     */
+    M2MResource       *_batchResource;
+
+    /** The thread that brings up the network interface.
+     */
+    Thread            *_attachThread;
+
+    /** The network interface being brought up by _attachThread.
+     */
+    NetworkInterface  *_attachInterface;
+
+    /** True once the network interface is attached.
+     */
+    volatile bool      _attached;
+
+    /** True once connect() has been called after attaching.
+     */
+    bool               _attachConnected;
+
+    /** Timer from construction, for boot to registered timing.
+     */
+    Timer              _bootTimer;
+
+    /** Construction to first registration, -1 if not yet registered.
+     */
+    int                _bootToRegisteredMs;
+
+    /** The power policy table.
+     */
+    const PowerPolicy *_powerPolicyTable;
+
+    /** The number of entries in _powerPolicyTable.
+     */
+    int                _powerPolicyNumEntries;
+
+    /** The power policy entry in force, NULL if none.
+     */
+    const PowerPolicy *_powerPolicy;
+
+    /** Timer since the last keep-alive was sent.
+     */
+    Timer              _keepAliveTimer;
+
+    /** When, on _bootTimer, each power source Voltage ([x][0]) and
+     * Current ([x][1]) was last reported, each being rate-limited
+     * on its own.
+     */
+    int                _powerReportMs[MAX_NUM_POWER_SOURCES][2];
+
+    /** Power source Voltage and Current values held
+     * back by the power policy.
+     */
+    int                _pendingVoltageMV[MAX_NUM_POWER_SOURCES];
+    int                _pendingCurrentMA[MAX_NUM_POWER_SOURCES];
+
+    /** Bit-map of held back values: bit 2 * instance for
+     * Voltage, bit 2 * instance + 1 for Current.
+     */
+    uint32_t           _pendingPowerSourceResources;
+
+    /** Callback to be called with firmware update download progress.
+     */
+    Callback<void(int)> _updateProgressUserCallback;
+};
+
+template <> struct CloudClientDm::ResourceTraits<int64_t> {
+    static const M2MResourceInstance::ResourceType type = M2MResourceInstance::INTEGER;
+    static bool write(M2MResource *resource, int64_t value)
+    {
+        return resource->set_value(value);
+    }
+    static void read(M2MResource *resource, int64_t *value)
+    {
+        *value = resource->get_value_int();
+    }
+};
+
+template <> struct CloudClientDm::ResourceTraits<int> {
+    static const M2MResourceInstance::ResourceType type = M2MResourceInstance::INTEGER;
+    static bool write(M2MResource *resource, int value)
+    {
+        return resource->set_value((int64_t) value);
+    }
+    static void read(M2MResource *resource, int *value)
+    {
+        *value = (int) resource->get_value_int();
+    }
+};
+
+template <> struct CloudClientDm::ResourceTraits<bool> {
+    static const M2MResourceInstance::ResourceType type = M2MResourceInstance::BOOLEAN;
+    static bool write(M2MResource *resource, bool value)
+    {
+        return resource->set_value((int64_t) value);
+    }
+    static void read(M2MResource *resource, bool *value)
+    {
+        *value = (resource->get_value_int() != 0);
+    }
+};
+
+template <> struct CloudClientDm::ResourceTraits<float> {
+    static const M2MResourceInstance::ResourceType type = M2MResourceInstance::FLOAT;
+    static bool write(M2MResource *resource, float value)
+    {
+        char buffer[16];
+        int length = snprintf(buffer, sizeof(buffer), "%g", value);
+        return resource->set_value((const uint8_t *) buffer, length);
+    }
+    static void read(M2MResource *resource, float *value)
+    {
+        *value = strtof(resource->get_value_string().c_str(), NULL);
+    }
+};
+
+template <> struct CloudClientDm::ResourceTraits<std::string> {
+    static const M2MResourceInstance::ResourceType type = M2MResourceInstance::STRING;
+    static bool write(M2MResource *resource, const std::string &value)
+    {
+        return resource->set_value((const uint8_t *) value.c_str(), value.length());
+    }
+    static void read(M2MResource *resource, std::string *value)
+    {
+        String string = resource->get_value_string();
+        value->assign(string.c_str(), string.length());
+    }
 };
 
 #endif // _CLOUD_CLIENT_DM_
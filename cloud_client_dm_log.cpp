@@ -0,0 +1,439 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2017 u-blox
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdarg.h>
+#include "mbed.h"
+#include "cloud_client_dm_log.h"
+
+/**********************************************************************
+ * TYPES
+ **********************************************************************/
+
+// The types of argument that a conversion specification can consume.
+typedef enum {
+    ARG_NONE,
+    ARG_INT,
+    ARG_LONG,
+    ARG_LONG_LONG,
+    ARG_POINTER,
+    ARG_STRING,
+    ARG_DOUBLE,
+    ARG_UNSUPPORTED
+} ArgType;
+
+/**********************************************************************
+ * STATIC VARIABLES
+ **********************************************************************/
+
+// The ring buffer of log records.
+static CloudClientDmLogRecord ring[CLOUD_CLIENT_DM_LOG_RING_SIZE];
+
+// The index in the ring buffer that the next record will be written to.
+static unsigned int writeIndex = 0;
+
+// The number of records in the ring buffer that have not yet been flushed.
+static unsigned int numRecords = 0;
+
+// The number of records that were overwritten before being flushed.
+static uint32_t numDropped = 0;
+
+#if CLOUD_CLIENT_DM_LOG_THREAD
+// The low-priority thread that flushes the ring buffer.
+static Thread *flushThread = NULL;
+#endif
+
+/**********************************************************************
+ * STATIC FUNCTIONS
+ **********************************************************************/
+
+// Find the next conversion specification in format, returning a
+// pointer to its '%' (or to the terminator if there is none),
+// setting *end to point just past it and *type to the type of the
+// argument it consumes.  "%%" is not a conversion specification.
+static const char *nextConversion(const char *format, const char **end,
+                                  ArgType *type)
+{
+    const char *start = format;
+    const char *p;
+    int numLong = 0;
+
+    *type = ARG_NONE;
+
+    // Find the '%', skipping "%%"
+    while ((*start != 0) && ((*start != '%') || (*(start + 1) == '%'))) {
+        if (*start == '%') {
+            start++;
+        }
+        start++;
+    }
+    *end = start;
+
+    if (*start == '%') {
+        p = start + 1;
+        // Skip flags, field width and precision
+        while ((*p != 0) && (strchr("-+ #0123456789.", *p) != NULL)) {
+            p++;
+        }
+        // Count the length modifiers
+        while ((*p == 'l') || (*p == 'h')) {
+            if (*p == 'l') {
+                numLong++;
+            }
+            p++;
+        }
+
+        switch (*p) {
+            case 'd':
+            case 'i':
+            case 'o':
+            case 'u':
+            case 'x':
+            case 'X':
+            case 'c':
+                if (numLong == 0) {
+                    *type = ARG_INT;
+                } else if (numLong == 1) {
+                    *type = ARG_LONG;
+                } else {
+                    *type = ARG_LONG_LONG;
+                }
+                break;
+            case 's':
+                *type = ARG_STRING;
+                break;
+            case 'p':
+                *type = ARG_POINTER;
+                break;
+            case 'f':
+            case 'F':
+            case 'e':
+            case 'E':
+            case 'g':
+            case 'G':
+            case 'a':
+            case 'A':
+                *type = ARG_DOUBLE;
+                break;
+            default:
+                // Includes "*", "n", "L", "z", "j" and "t"
+                *type = ARG_UNSUPPORTED;
+                break;
+        }
+
+        if (*p != 0) {
+            p++;
+        }
+        *end = p;
+    }
+
+    return start;
+}
+
+// Store an argument of the given size in the record's argument slots.
+static bool storeArg(CloudClientDmLogRecord *record, unsigned int *slot,
+                     const void *value, size_t size)
+{
+    unsigned int numSlots = (size + sizeof(uintptr_t) - 1) / sizeof(uintptr_t);
+    bool success = false;
+
+    if (*slot + numSlots <= CLOUD_CLIENT_DM_LOG_MAX_ARGS) {
+        memcpy(&(record->args[*slot]), value, size);
+        *slot += numSlots;
+        success = true;
+    }
+
+    return success;
+}
+
+// Copy the text of a string argument into the record, storing
+// its offset in the record's argument slots.
+static bool storeString(CloudClientDmLogRecord *record, unsigned int *slot,
+                        unsigned int *used, const char *string)
+{
+    size_t offset = sizeof(record->strings) - 1;
+    size_t length;
+
+    if (string == NULL) {
+        string = "(null)";
+    }
+    // When there is no room left, point at the terminator at the end
+    if (*used < sizeof(record->strings) - 1) {
+        offset = *used;
+        length = strlen(string);
+        if (length > sizeof(record->strings) - 1 - offset) {
+            length = sizeof(record->strings) - 1 - offset;
+        }
+        memcpy(record->strings + offset, string, length);
+        record->strings[offset + length] = 0;
+        *used += length + 1;
+    }
+
+    return storeArg(record, slot, &offset, sizeof(offset));
+}
+
+// Load an argument of the given size from the record's argument slots.
+static bool loadArg(const CloudClientDmLogRecord *record, unsigned int *slot,
+                    void *value, size_t size)
+{
+    unsigned int numSlots = (size + sizeof(uintptr_t) - 1) / sizeof(uintptr_t);
+    bool success = false;
+
+    if (*slot + numSlots <= record->numArgs) {
+        memcpy(value, &(record->args[*slot]), size);
+        *slot += numSlots;
+        success = true;
+    }
+
+    return success;
+}
+
+// Print a literal part of a format string, converting "%%" to '%'.
+static void printLiteral(const char *start, const char *end)
+{
+    while (start < end) {
+        putchar(*start);
+        if ((*start == '%') && (start + 1 < end) && (*(start + 1) == '%')) {
+            start++;
+        }
+        start++;
+    }
+}
+
+// Format and print a single log record.
+static void printRecord(const CloudClientDmLogRecord *record)
+{
+    const char *p = record->format;
+    const char *start;
+    const char *end;
+    char spec[16];
+    unsigned int slot = 0;
+    ArgType type;
+    int valueInt;
+    long valueLong;
+    long long valueLongLong;
+    const void *valuePointer;
+    size_t valueOffset;
+    double valueDouble;
+    bool printed;
+
+    do {
+        start = nextConversion(p, &end, &type);
+        printLiteral(p, start);
+        printed = false;
+        if ((type != ARG_NONE) && (type != ARG_UNSUPPORTED) &&
+            ((unsigned int) (end - start) < sizeof(spec))) {
+            memcpy(spec, start, end - start);
+            spec[end - start] = 0;
+            switch (type) {
+                case ARG_INT:
+                    if (loadArg(record, &slot, &valueInt, sizeof(valueInt))) {
+                        printf(spec, valueInt);
+                        printed = true;
+                    }
+                    break;
+                case ARG_LONG:
+                    if (loadArg(record, &slot, &valueLong, sizeof(valueLong))) {
+                        printf(spec, valueLong);
+                        printed = true;
+                    }
+                    break;
+                case ARG_LONG_LONG:
+                    if (loadArg(record, &slot, &valueLongLong, sizeof(valueLongLong))) {
+                        printf(spec, valueLongLong);
+                        printed = true;
+                    }
+                    break;
+                case ARG_POINTER:
+                    if (loadArg(record, &slot, &valuePointer, sizeof(valuePointer))) {
+                        printf(spec, valuePointer);
+                        printed = true;
+                    }
+                    break;
+                case ARG_STRING:
+                    if (loadArg(record, &slot, &valueOffset, sizeof(valueOffset)) &&
+                        (valueOffset < sizeof(record->strings))) {
+                        printf(spec, record->strings + valueOffset);
+                        printed = true;
+                    }
+                    break;
+                case ARG_DOUBLE:
+                    if (loadArg(record, &slot, &valueDouble, sizeof(valueDouble))) {
+                        printf(spec, valueDouble);
+                        printed = true;
+                    }
+                    break;
+                default:
+                    break;
+            }
+        }
+        if (!printed) {
+            // Out of arguments or unsupported, print the rest as-is
+            printf("%s", start);
+        }
+        p = end;
+    } while (printed);
+}
+
+#if CLOUD_CLIENT_DM_LOG_THREAD
+// The body of the low-priority flush thread.
+static void flushThreadFunction()
+{
+    for (;;) {
+        cloudClientDmLogFlush();
+        Thread::wait(CLOUD_CLIENT_DM_LOG_FLUSH_INTERVAL_MS);
+    }
+}
+#endif
+
+/**********************************************************************
+ * PUBLIC FUNCTIONS
+ **********************************************************************/
+
+// Record a log statement in the ring buffer.
+void cloudClientDmLogWrite(int level, const char *format, ...)
+{
+    CloudClientDmLogRecord record;
+    const char *p = format;
+    unsigned int slot = 0;
+    unsigned int stringsUsed = 0;
+    ArgType type;
+    int valueInt;
+    long valueLong;
+    long long valueLongLong;
+    const void *valuePointer;
+    double valueDouble;
+    bool stored;
+    va_list args;
+
+    record.format = format;
+    record.strings[sizeof(record.strings) - 1] = 0;
+    record.level = (uint8_t) level;
+
+    // Pull the raw arguments off the stack; no formatting is done here
+    va_start(args, format);
+    do {
+        nextConversion(p, &p, &type);
+        stored = false;
+        switch (type) {
+            case ARG_INT:
+                valueInt = va_arg(args, int);
+                stored = storeArg(&record, &slot, &valueInt, sizeof(valueInt));
+                break;
+            case ARG_LONG:
+                valueLong = va_arg(args, long);
+                stored = storeArg(&record, &slot, &valueLong, sizeof(valueLong));
+                break;
+            case ARG_LONG_LONG:
+                valueLongLong = va_arg(args, long long);
+                stored = storeArg(&record, &slot, &valueLongLong, sizeof(valueLongLong));
+                break;
+            case ARG_POINTER:
+                valuePointer = va_arg(args, const void *);
+                stored = storeArg(&record, &slot, &valuePointer, sizeof(valuePointer));
+                break;
+            case ARG_STRING:
+                stored = storeString(&record, &slot, &stringsUsed, va_arg(args, const char *));
+                break;
+            case ARG_DOUBLE:
+                valueDouble = va_arg(args, double);
+                stored = storeArg(&record, &slot, &valueDouble, sizeof(valueDouble));
+                break;
+            default:
+                break;
+        }
+    } while (stored);
+    va_end(args);
+    record.numArgs = (uint8_t) slot;
+
+    core_util_critical_section_enter();
+    ring[writeIndex] = record;
+    writeIndex = (writeIndex + 1) % CLOUD_CLIENT_DM_LOG_RING_SIZE;
+    if (numRecords < CLOUD_CLIENT_DM_LOG_RING_SIZE) {
+        numRecords++;
+    } else {
+        numDropped++;
+    }
+    core_util_critical_section_exit();
+}
+
+// Format and print the records in the ring buffer.
+int cloudClientDmLogFlush(int maxRecords)
+{
+    CloudClientDmLogRecord record;
+    int count = 0;
+    bool gotOne = true;
+
+    while (gotOne && ((maxRecords < 0) || (count < maxRecords))) {
+        gotOne = false;
+        core_util_critical_section_enter();
+        if (numRecords > 0) {
+            record = ring[(writeIndex + CLOUD_CLIENT_DM_LOG_RING_SIZE - numRecords) %
+                          CLOUD_CLIENT_DM_LOG_RING_SIZE];
+            numRecords--;
+            gotOne = true;
+        }
+        core_util_critical_section_exit();
+
+        if (gotOne) {
+            printRecord(&record);
+            count++;
+        }
+    }
+
+    return count;
+}
+
+// Start the low-priority flush thread.
+bool cloudClientDmLogStart()
+{
+#if CLOUD_CLIENT_DM_LOG_THREAD
+    if (flushThread == NULL) {
+        flushThread = new Thread(osPriorityLow, CLOUD_CLIENT_DM_LOG_THREAD_STACK_SIZE);
+        if (flushThread->start(callback(flushThreadFunction)) != osOK) {
+            delete flushThread;
+            flushThread = NULL;
+        }
+    }
+
+    return (flushThread != NULL);
+#else
+    return false;
+#endif
+}
+
+// Get the number of records that were overwritten before being flushed.
+uint32_t cloudClientDmLogDropped()
+{
+    return numDropped;
+}
+
+// Get the raw ring buffer.
+const CloudClientDmLogRecord *cloudClientDmLogRing(unsigned int *writeIndexPtr,
+                                                   unsigned int *numRecordsPtr)
+{
+    core_util_critical_section_enter();
+    if (writeIndexPtr != NULL) {
+        *writeIndexPtr = writeIndex;
+    }
+    if (numRecordsPtr != NULL) {
+        *numRecordsPtr = numRecords;
+    }
+    core_util_critical_section_exit();
+
+    return ring;
+}
+
+// End of file
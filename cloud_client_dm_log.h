@@ -0,0 +1,196 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2017 u-blox
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _CLOUD_CLIENT_DM_LOG_
+#define _CLOUD_CLIENT_DM_LOG_
+
+#include "mbed.h"
+
+/* A low-overhead logging backend for CloudClientDm.
+ *
+ * Rather than formatting a log statement and writing it to the
+ * console there and then (which, at 115200 baud, can stall the
+ * calling thread for milliseconds), each log statement records
+ * only a pointer to its format string, which lives in flash and
+ * so serves as the format ID, plus its raw arguments into a
+ * fixed-size ring buffer in RAM.  The records are formatted later,
+ * either by a low-priority thread calling cloudClientDmLogFlush()
+ * or by dumping the ring buffer and decoding it on a host, looking
+ * the format strings up in the map/ELF file.
+ *
+ * Log statements may be compiled out entirely, by level, by
+ * defining CLOUD_CLIENT_DM_LOG_LEVEL (e.g. in the "macros" section
+ * of mbed_app.json).
+ *
+ * Note: the text of string ("%s") arguments is copied into the
+ * record, since it may well not outlive the call, but only up to
+ * CLOUD_CLIENT_DM_LOG_STRING_SIZE bytes in all for each record,
+ * beyond which it is truncated.  Also, "*" is not supported as a
+ * field width or precision.
+ */
+
+/** The log levels.
+ */
+#define CLOUD_CLIENT_DM_LOG_LEVEL_NONE  0
+#define CLOUD_CLIENT_DM_LOG_LEVEL_ERROR 1
+#define CLOUD_CLIENT_DM_LOG_LEVEL_WARN  2
+#define CLOUD_CLIENT_DM_LOG_LEVEL_INFO  3
+#define CLOUD_CLIENT_DM_LOG_LEVEL_DEBUG 4
+
+/** Log statements above this level are compiled out.
+ */
+#ifndef CLOUD_CLIENT_DM_LOG_LEVEL
+# define CLOUD_CLIENT_DM_LOG_LEVEL CLOUD_CLIENT_DM_LOG_LEVEL_INFO
+#endif
+
+/** Set to 0 to format and print log statements synchronously,
+ * as was always done before.
+ */
+#ifndef CLOUD_CLIENT_DM_LOG_DEFERRED
+# define CLOUD_CLIENT_DM_LOG_DEFERRED 1
+#endif
+
+/** The number of records in the ring buffer; when the ring
+ * buffer is full the oldest record is overwritten.
+ */
+#ifndef CLOUD_CLIENT_DM_LOG_RING_SIZE
+# define CLOUD_CLIENT_DM_LOG_RING_SIZE 64
+#endif
+
+/** The maximum number of argument slots in a record.  Note that
+ * a 64-bit integer or a double occupies two slots on a 32-bit
+ * target.
+ */
+#ifndef CLOUD_CLIENT_DM_LOG_MAX_ARGS
+# define CLOUD_CLIENT_DM_LOG_MAX_ARGS 4
+#endif
+
+/** The number of bytes of string ("%s") argument text, including
+ * terminators, that a record can hold, shared between all of its
+ * string arguments; longer strings are truncated.
+ */
+#ifndef CLOUD_CLIENT_DM_LOG_STRING_SIZE
+# define CLOUD_CLIENT_DM_LOG_STRING_SIZE 40
+#endif
+
+/** Set to 0 to not run the low-priority flush thread, e.g. if
+ * the ring buffer is to be decoded on a host instead.
+ */
+#ifndef CLOUD_CLIENT_DM_LOG_THREAD
+# define CLOUD_CLIENT_DM_LOG_THREAD 1
+#endif
+
+/** The stack size of the low-priority flush thread.
+ */
+#ifndef CLOUD_CLIENT_DM_LOG_THREAD_STACK_SIZE
+# define CLOUD_CLIENT_DM_LOG_THREAD_STACK_SIZE 2048
+#endif
+
+/** How often the low-priority flush thread empties the ring buffer.
+ */
+#ifndef CLOUD_CLIENT_DM_LOG_FLUSH_INTERVAL_MS
+# define CLOUD_CLIENT_DM_LOG_FLUSH_INTERVAL_MS 100
+#endif
+
+/** A log record, as stored in the ring buffer.
+ */
+typedef struct {
+    const char *format;
+    uint8_t level;
+    uint8_t numArgs;
+    uintptr_t args[CLOUD_CLIENT_DM_LOG_MAX_ARGS];
+
+    /** The text of "%s" arguments, whose slots hold offsets into here.
+     */
+    char strings[CLOUD_CLIENT_DM_LOG_STRING_SIZE];
+} CloudClientDmLogRecord;
+
+#if CLOUD_CLIENT_DM_LOG_DEFERRED
+# define CLOUD_CLIENT_DM_LOG_WRITE(on, level, format, ...) do {if (on) {cloudClientDmLogWrite(level, format, ## __VA_ARGS__);}} while (0)
+#else
+# define CLOUD_CLIENT_DM_LOG_WRITE(on, level, format, ...) debug_if(on, format, ## __VA_ARGS__)
+#endif
+
+#if CLOUD_CLIENT_DM_LOG_LEVEL >= CLOUD_CLIENT_DM_LOG_LEVEL_ERROR
+# define CLOUD_CLIENT_DM_LOG_ERROR(on, format, ...) CLOUD_CLIENT_DM_LOG_WRITE(on, CLOUD_CLIENT_DM_LOG_LEVEL_ERROR, format, ## __VA_ARGS__)
+#else
+# define CLOUD_CLIENT_DM_LOG_ERROR(on, format, ...) do {} while (0)
+#endif
+
+#if CLOUD_CLIENT_DM_LOG_LEVEL >= CLOUD_CLIENT_DM_LOG_LEVEL_WARN
+# define CLOUD_CLIENT_DM_LOG_WARN(on, format, ...) CLOUD_CLIENT_DM_LOG_WRITE(on, CLOUD_CLIENT_DM_LOG_LEVEL_WARN, format, ## __VA_ARGS__)
+#else
+# define CLOUD_CLIENT_DM_LOG_WARN(on, format, ...) do {} while (0)
+#endif
+
+#if CLOUD_CLIENT_DM_LOG_LEVEL >= CLOUD_CLIENT_DM_LOG_LEVEL_INFO
+# define CLOUD_CLIENT_DM_LOG_INFO(on, format, ...) CLOUD_CLIENT_DM_LOG_WRITE(on, CLOUD_CLIENT_DM_LOG_LEVEL_INFO, format, ## __VA_ARGS__)
+#else
+# define CLOUD_CLIENT_DM_LOG_INFO(on, format, ...) do {} while (0)
+#endif
+
+#if CLOUD_CLIENT_DM_LOG_LEVEL >= CLOUD_CLIENT_DM_LOG_LEVEL_DEBUG
+# define CLOUD_CLIENT_DM_LOG_DEBUG(on, format, ...) CLOUD_CLIENT_DM_LOG_WRITE(on, CLOUD_CLIENT_DM_LOG_LEVEL_DEBUG, format, ## __VA_ARGS__)
+#else
+# define CLOUD_CLIENT_DM_LOG_DEBUG(on, format, ...) do {} while (0)
+#endif
+
+/** Record a log statement in the ring buffer.  This does not
+ * format anything and is safe to call from any thread.
+ *
+ * @param level  the log level.
+ * @param format the printf()-style format string; this must
+ *               be a string literal.
+ */
+void cloudClientDmLogWrite(int level, const char *format, ...);
+
+/** Format and print the records in the ring buffer, oldest first.
+ *
+ * @param maxRecords the maximum number of records to print,
+ *                   -1 for all of them.
+ * @return           the number of records printed.
+ */
+int cloudClientDmLogFlush(int maxRecords = -1);
+
+/** Start the low-priority thread that flushes the ring buffer
+ * periodically.  This may be called any number of times, only
+ * one thread is ever started.
+ *
+ * @return true if the thread is running, otherwise false.
+ */
+bool cloudClientDmLogStart();
+
+/** Get the number of records that were overwritten before
+ * they could be flushed.
+ *
+ * @return the number of lost records.
+ */
+uint32_t cloudClientDmLogDropped();
+
+/** Get the raw ring buffer, e.g. for dumping to a host-side decoder.
+ * The unflushed records run from index (writeIndex - numRecords)
+ * to (writeIndex - 1), modulo CLOUD_CLIENT_DM_LOG_RING_SIZE.
+ *
+ * @param writeIndex a place to put the write index.
+ * @param numRecords a place to put the number of unflushed records.
+ * @return           a pointer to the start of the ring buffer.
+ */
+const CloudClientDmLogRecord *cloudClientDmLogRing(unsigned int *writeIndex,
+                                                   unsigned int *numRecords);
+
+#endif // _CLOUD_CLIENT_DM_LOG_
+
+// End of file